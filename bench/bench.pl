@@ -0,0 +1,183 @@
+#!/usr/bin/env perl
+# Copyright 2022 Vlad Mesco
+# 
+# Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+# 
+# 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+# 
+# 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# Times jakobmenu over generated corpora; see "Benchmarks" in README.md.
+#
+#   perl bench/bench.pl [-sizes="100 1000 10000"] [-runs=5] ./jakobmenu
+#
+# Every run is made with -J, so jakobmenu reports how long each phase took,
+# and the median of the runs is printed as one JSON object per line (corpus
+# size, scenario, per-phase wall seconds, total CPU and wall seconds).
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw(make_path remove_tree);
+use File::Basename qw(dirname);
+use Time::HiRes qw(time);
+use POSIX qw(strftime);
+
+my $sizes = "100 1000 10000";
+my $runs = 5;
+my $work = "/tmp/jakobmenu-bench";
+my $showHelp = 0;
+
+GetOptions("sizes=s" => \$sizes,
+           "runs=i" => \$runs,
+           "work=s" => \$work,
+           "help" => \$showHelp)
+           or die("Error parsing command line");
+
+my $binary = shift(@ARGV) || "./jakobmenu";
+
+if($showHelp) {
+    print <<EOT;
+$0 [-sizes="100 1000 10000"] [-runs=5] [-work=/tmp/jakobmenu-bench] [jakobmenu]
+    -sizes="N ..."  corpus sizes to run, in .desktop files (up to 100000)
+    -runs=N         runs per scenario; the median is reported
+    -work=DIR       where corpora and the fake \$HOME go; corpora are
+                    kept between invocations
+EOT
+    exit(1);
+}
+
+die("$binary is not executable\n") unless -x $binary;
+my $here = dirname(__FILE__);
+
+# a clean $HOME, so neither a user config nor a real cache gets in the way
+my $home = "$work/home";
+my $cache = "$home/.cache/jakobmenu/index";
+$ENV{HOME} = $home;
+warn("/etc/jakobmenu.conf exists; its path= directories are benchmarked too\n")
+    if -e "/etc/jakobmenu.conf";
+
+# pages can only be dropped for everything as root; otherwise GNU dd can
+# drop them file by file
+my $canDropAll = -w "/proc/sys/vm/drop_caches";
+my $canDropFiles = !$canDropAll && `dd --help 2>&1` =~ /nocache/;
+warn("can't drop the page cache, skipping the cold runs\n")
+    unless $canDropAll || $canDropFiles;
+
+sub dropCaches
+{
+    my @files = @_;
+    system("sync");
+    if($canDropAll) {
+        open(my $fh, ">", "/proc/sys/vm/drop_caches") or return 0;
+        print $fh "3\n";
+        close($fh);
+        return 1;
+    }
+    return 0 unless $canDropFiles;
+    for my $f (@files) {
+        system("dd", "if=$f", "iflag=nocache", "count=0", "status=none");
+    }
+    return 1;
+}
+
+# runs jakobmenu once; returns a hash of phase => seconds, plus wall
+sub runOnce
+{
+    my @args = @_;
+    my %phases;
+    my $start = time();
+    my $pid = open(my $err, "-|");
+    die("fork: $!") unless defined($pid);
+    if(!$pid) {
+        open(STDERR, ">&", \*STDOUT) or die;
+        open(STDOUT, ">", "/dev/null") or die;
+        exec($binary, "-J", @args) or die("exec $binary: $!");
+    }
+    while(<$err>) {
+        if(/^\{"phases":/) {
+            while(/"(\w+)":\{"wall":([0-9.]+),"cpu":([0-9.]+)\}/g) {
+                if($1 eq "total") {
+                    $phases{cpu} = $3;
+                } elsif($2 > 0) {
+                    $phases{$1} = $2;
+                }
+            }
+        } else {
+            print STDERR $_;
+        }
+    }
+    close($err);
+    die("$binary @args failed\n") if $?;
+    $phases{wall} = time() - $start;
+    return \%phases;
+}
+
+sub median
+{
+    my @v = sort { $a <=> $b } @_;
+    return 0 unless @v;
+    return @v % 2 ? $v[$#v / 2] : ($v[@v / 2 - 1] + $v[@v / 2]) / 2;
+}
+
+sub report
+{
+    my ($size, $scenario, @samples) = @_;
+    my %keys;
+    for my $s (@samples) { $keys{$_} = 1 for keys(%$s); }
+    my @fields;
+    for my $k (sort keys %keys) {
+        push @fields, sprintf("\"%s\":%.6f", $k, median(map { $_->{$k} || 0 } @samples));
+    }
+    printf("{\"files\":%d,\"scenario\":\"%s\",\"runs\":%d,%s}\n",
+        $size, $scenario, scalar(@samples), join(",", @fields));
+}
+
+my $rev = `git -C "$here" rev-parse --short HEAD 2>/dev/null` || "unknown";
+chomp($rev);
+printf("{\"bench\":\"jakobmenu\",\"revision\":\"%s\",\"date\":\"%s\",\"runs\":%d}\n",
+    $rev, strftime("%Y-%m-%dT%H:%M:%SZ", gmtime()), $runs);
+
+for my $size (split(/\s+/, $sizes)) {
+    next unless $size;
+    my $corpus = "$work/corpus-$size";
+    unless(-e "$corpus/.done") {
+        remove_tree($corpus);
+        system($^X, "$here/gencorpus.pl", "-files=$size", "-out=$corpus") == 0
+            or die("gencorpus.pl failed\n");
+        open(my $fh, ">", "$corpus/.done") or die;
+        close($fh);
+    }
+    my @dirs = map { "$corpus/$_" } qw(system local flatpak);
+    my @paths = map { ("-p", $_) } @dirs;
+    my @files = map { glob("$_/*.desktop") } @dirs;
+    # a corpus written this very second would never be trusted by the cache
+    my $old = int(time()) - 3600;
+    utime($old, $old, @files, @dirs);
+
+    # everything parsed, nothing cached
+    if($canDropAll || $canDropFiles) {
+        report($size, "cold", map { dropCaches(@files); runOnce("-n", @paths) } 1..$runs);
+    }
+    runOnce("-n", @paths);
+    report($size, "warm", map { runOnce("-n", @paths) } 1..$runs);
+    report($size, "warm-all-categories", map { runOnce("-n", "-a", @paths) } 1..$runs);
+
+    # a fresh cache: map the index and render
+    unlink($cache);
+    runOnce(@paths);
+    report($size, "cached", map { runOnce(@paths) } 1..$runs);
+    report($size, "search", map { runOnce("-s", "edit", @paths) } 1..$runs);
+
+    # one file changed since the cache was written
+    my $victim = $files[0];
+    report($size, "one-changed", map {
+        # back in time, so the new mtimes are never in the second of the scan
+        my $t = int(time()) - 10 - $_;
+        utime($t, $t, $victim, dirname($victim));
+        runOnce(@paths);
+    } 1..$runs);
+}
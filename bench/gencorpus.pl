@@ -0,0 +1,200 @@
+#!/usr/bin/env perl
+# Copyright 2022 Vlad Mesco
+# 
+# Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+# 
+# 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+# 
+# 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+# 
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# Generates a tree of .desktop files that looks like what a desktop
+# install has lying around, for bench.pl.
+#
+#   perl bench/gencorpus.pl -files=10000 -out=/tmp/corpus
+#
+# The files are spread over three directories, like /usr/share/applications,
+# ~/.local/share/applications and a flatpak exports dir would be, and the
+# output only depends on -files and -seed.
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw(make_path);
+
+my $files = 1000;
+my $out = "corpus";
+my $seed = 42;
+my $showHelp = 0;
+
+GetOptions("files=i" => \$files,
+           "out=s" => \$out,
+           "seed=i" => \$seed,
+           "help" => \$showHelp)
+           or die("Error parsing command line");
+
+if($showHelp) {
+    print <<EOT;
+$0 [-files=1000] [-out=corpus] [-seed=42]
+    -files=N        how many .desktop files to write
+    -out=DIR        where to put them; DIR/system, DIR/local and
+                    DIR/flatpak are created
+    -seed=N         random seed
+EOT
+    exit(1);
+}
+
+srand($seed);
+
+# registered main and additional categories, plus some vendor ones
+my @main = qw(AudioVideo Audio Video Development Education Game Graphics
+              Network Office Science Settings System Utility);
+my @additional = qw(Building Debugger IDE GUIDesigner Profiling
+    RevisionControl Translation Calendar ContactManagement Database
+    Dictionary Chart Email Finance FlowChart PDA ProjectManagement
+    Presentation Spreadsheet WordProcessor 2DGraphics VectorGraphics
+    RasterGraphics 3DGraphics Scanning OCR Photography Publishing Viewer
+    TextTools DesktopSettings HardwareSettings Printing PackageManager
+    Dialup InstantMessaging Chat IRCClient Feed FileTransfer HamRadio News
+    P2P RemoteAccess Telephony TelephonyTools VideoConference WebBrowser
+    WebDevelopment Midi Mixer Sequencer Tuner TV AudioVideoEditing Player
+    Recorder DiscBurning ActionGame AdventureGame ArcadeGame BoardGame
+    BlocksGame CardGame KidsGame LogicGame RolePlaying Shooter Simulation
+    SportsGame StrategyGame Art Construction Music Languages
+    ArtificialIntelligence Astronomy Biology Chemistry ComputerScience
+    DataVisualization Economy Electricity Geography Geology Geoscience
+    History Humanities ImageProcessing Literature Maps Math
+    NumericalAnalysis MedicalSoftware Physics Robotics Spirituality Sports
+    ParallelComputing Amusement Archiving Compression Electronics Emulator
+    Engineering FileTools FileManager TerminalEmulator Filesystem Monitor
+    Security Accessibility Calculator Clock TextEditor Documentation Adult
+    Core KDE GNOME XFCE GTK Qt Motif Java ConsoleOnly);
+my @vendor = qw(X-GNOME-Utilities X-KDE-settings-system X-XFCE X-Red-Hat-Base
+                X-SuSE-Core x-gnome-other X-Flatpak);
+
+my @locales = qw(af ar ast be bg bn br bs ca ca@valencia cs cy da de el
+    en_AU en_CA en_GB eo es es_AR es_MX et eu fa fi fr fur ga gd gl he hi
+    hr hu hy id is it ja ka kk km kn ko lt lv mk ml mr ms nb nds ne nl nn
+    oc pa pl pt pt_BR ro ru si sk sl sq sr sr@latin sr@ije sv ta te th tr
+    ug uk vi zh_CN zh_HK zh_TW);
+
+my @words = qw(file image sound video text note mail chat web system disk
+    network power print scan photo music movie game office sheet slide
+    draw paint code debug build test term shell monitor clock map weather
+    backup archive font color screen record stream torrent editor viewer
+    manager browser player reader writer studio center tool tweak);
+
+sub pick { return $_[int(rand(@_))]; }
+sub chance { return rand() < $_[0]; }
+
+sub appName
+{
+    my $n = 1 + int(rand(3));
+    my $name = join(" ", map { ucfirst(pick(@words)) } 1..$n);
+    # a few names that need escaping
+    $name .= " & " . ucfirst(pick(@words)) if chance(0.02);
+    $name = "<$name>" if chance(0.005);
+    return $name;
+}
+
+sub execLine
+{
+    my ($id) = @_;
+    my $exec = "/usr/bin/$id";
+    $exec = "flatpak run --branch=stable --arch=x86_64 --command=$id org.example.\u$id" if chance(0.1);
+    if(chance(0.1)) {
+        # wrapper scripts and env prefixes make for long lines
+        my $n = 20 + int(rand(200));
+        $exec = "env " . join(" ", map { "VAR_$_=" . pick(@words) x 3 } 1..$n) . " $exec";
+    }
+    $exec .= " --" . pick(@words) for 1..int(rand(4));
+    $exec .= " " . pick("%U", "%u", "%F", "%f", "%i %c %k") if chance(0.7);
+    return $exec;
+}
+
+sub categories
+{
+    my @c = (pick(@main));
+    push @c, pick(@additional) for 1..int(rand(4));
+    push @c, pick(@vendor) if chance(0.2);
+    return join(";", @c) . ";";
+}
+
+sub localized
+{
+    my ($fh, $key, $value, $count) = @_;
+    for my $locale ((@locales)[0..$count - 1]) {
+        print $fh "$key\[$locale\]=$value ($locale)\n";
+    }
+}
+
+sub desktopFile
+{
+    my ($fh, $id) = @_;
+    my $name = appName();
+    # heavy localization is the norm for anything from a big project
+    my $nlocales = chance(0.4) ? scalar(@locales)
+                 : chance(0.5) ? int(rand(20))
+                 : 0;
+
+    print $fh "#!/usr/bin/env xdg-open\n" if chance(0.05);
+    print $fh "# generated for jakobmenu benchmarks\n\n" if chance(0.2);
+    print $fh "[Desktop Entry]\n";
+    print $fh "Version=1.0\n" if chance(0.5);
+    print $fh "Type=" . (chance(0.01) ? pick("Link", "Directory") : "Application") . "\n";
+    print $fh "Name=$name\n";
+    localized($fh, "Name", $name, $nlocales);
+    if(chance(0.7)) {
+        print $fh "GenericName=" . ucfirst(pick(@words)) . " " . pick(@words) . "\n";
+        localized($fh, "GenericName", "Generic", $nlocales);
+    }
+    if(chance(0.8)) {
+        print $fh "Comment=" . join(" ", map { pick(@words) } 1..8) . "\n";
+        localized($fh, "Comment", "Comment", $nlocales);
+    }
+    if(chance(0.5)) {
+        print $fh "Keywords=" . join(";", map { pick(@words) } 1..5) . ";\n";
+        localized($fh, "Keywords", "a;b;c", $nlocales);
+    }
+    print $fh "TryExec=$id\n" if chance(0.2);
+    print $fh "Exec=" . execLine($id) . "\n" unless chance(0.01);
+    print $fh "Path=/tmp\n" if chance(0.03);
+    print $fh "Icon=" . (chance(0.9) ? $id : "/usr/share/pixmaps/$id.png") . "\n";
+    print $fh "Terminal=" . (chance(0.05) ? "true" : "false") . "\n";
+    print $fh "StartupNotify=true\n" if chance(0.5);
+    print $fh "Categories=" . categories() . "\n" unless chance(0.03);
+    print $fh "MimeType=" . join(";", map { "application/x-" . pick(@words) } 1..int(rand(30))) . ";\n" if chance(0.3);
+    print $fh "NoDisplay=true\n" if chance(0.08);
+    print $fh "Hidden=true\n" if chance(0.02);
+    print $fh "X-GNOME-UsesNotifications=true\n" if chance(0.2);
+
+    if(chance(0.2)) {
+        my @actions = map { "action$_" } 1..(1 + int(rand(3)));
+        print $fh "Actions=" . join(";", @actions) . ";\n";
+        for my $action (@actions) {
+            print $fh "\n[Desktop Action $action]\n";
+            print $fh "Name=" . ucfirst(pick(@words)) . "\n";
+            localized($fh, "Name", "Action", $nlocales);
+            print $fh "Exec=/usr/bin/$id --$action\n";
+        }
+    }
+}
+
+my %dirs = (system => 0.85, local => 0.10, flatpak => 0.05);
+for my $dir (sort keys %dirs) {
+    make_path("$out/$dir");
+}
+
+for my $i (0..$files - 1) {
+    my $r = rand();
+    my $dir = $r < $dirs{system} ? "system"
+            : $r < $dirs{system} + $dirs{local} ? "local"
+            : "flatpak";
+    my $id = lc(pick(@words)) . $i;
+    my $path = "$out/$dir/org.example.$id.desktop";
+    open(my $fh, ">", $path) or die("Can't write $path: $!");
+    desktopFile($fh, $id);
+    close($fh);
+}
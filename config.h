@@ -0,0 +1,41 @@
+// This file was generated by ./configure.pl
+// Feel free to modify the defaults
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#ifndef _POSIX_C_SOURCE
+# define _POSIX_C_SOURCE 200809L
+#endif
+
+#ifndef _BSD_SOURCE
+# define _BSD_SOURCE
+#endif
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#define VERSION "0.1"
+#define PREFIX "/usr/local"
+
+#include <err.h>
+
+#define HAVE_PLEDGE 0
+#define HAVE_UNVEIL 0
+#define HAVE_PTHREAD 1
+#define HAVE_POSIX_FADVISE 1
+#define HAVE_IO_URING 1
+#define HAVE_GETDENTS64 1
+#define HAVE_INOTIFY 1
+#define HAVE_SPLICE 1
+#define HAVE_FLOCK 1
+#define HAVE_GETPEEREID 0
+#define HAVE_SO_PEERCRED 1
+
+#define ETC_CONF "/etc/jakobmenu.conf"
+#define HOME_CONF "~/.config/jakobmenu/conf"
+#define HOME_CACHE "~/.cache/jakobmenu/index"
+#define SHARED_CACHE "/var/cache/jakobmenu/index"
+
+
+#endif
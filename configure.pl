@@ -19,6 +19,8 @@ my $prefix = "/usr/local";
 my $showHelp = 0;
 my $etc_conf = "/etc/jakobmenu.conf";
 my $home_conf = "~/.config/jakobmenu/conf";
+my $home_cache = "~/.cache/jakobmenu/index";
+my $shared_cache = "/var/cache/jakobmenu/index";
 
 my $cflags = $ENV{CFLAGS} || "";
 my $ldflags = $ENV{LDFLAGS} || "";
@@ -28,7 +30,9 @@ my $VERSION = "0.1";
 GetOptions("prefix=s" => \$prefix,
            "help" => \$showHelp,
            "etc_conf=s" => \$etc_conf,
-           "user_conf=s" => \$home_conf)
+           "user_conf=s" => \$home_conf,
+           "user_cache=s" => \$home_cache,
+           "shared_cache=s" => \$shared_cache)
            or die("Error parsing command line");
 
 if($showHelp) {
@@ -41,6 +45,11 @@ $0 [-prefix=/usr/local]
                                            a quoted ~ will be expanded
                                            to the user's home directory
                                            at runtime.
+    -user_cache=\\~/.cache/jakobmenu/index
+                                           default menu cache path
+    -shared_cache=/var/cache/jakobmenu/index
+                                           default system-wide menu cache
+                                           path, see --shared-index
 
 This script generates Makefile.vars and config.h to generate sensible
 defaults based on what is detected in the environment, or your whims.
@@ -175,6 +184,152 @@ compile("for unveil", $unveilCode, $cc, sub {
     $defines{HAVE_UNVEIL} = ($compiles && $status == 0) ? 1 : 0;
 });
 
+my $pthreadCode = <<EOT;
+#include <pthread.h>
+static void* run(void* arg) { return arg; }
+int main(int argc, char* argv[]) {
+    pthread_t t;
+    void* rval = NULL;
+    if(pthread_create(&t, NULL, &run, &t)) return 1;
+    pthread_join(t, &rval);
+    return rval == &t ? 0 : 1;
+}
+EOT
+compile("for pthreads", $pthreadCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_PTHREAD} = ($compiles && $status == 0) ? 1 : 0;
+}, "-pthread");
+$ldflags = "-pthread $ldflags" if $defines{HAVE_PTHREAD};
+
+my $fadviseCode = <<EOT;
+#include <fcntl.h>
+int main(int argc, char* argv[]) {
+    int fd = open(argv[0], O_RDONLY);
+    return posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+}
+EOT
+compile("for posix_fadvise", $fadviseCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_POSIX_FADVISE} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+# only the headers are needed; whether the running kernel allows
+# io_uring is found out at runtime
+my $iouringCode = <<EOT;
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+int main(int argc, char* argv[]) {
+    struct io_uring_params p;
+    int ops[] = { IORING_OP_OPENAT, IORING_OP_READ };
+    memset(&p, 0, sizeof(p));
+    (void)ops;
+    syscall(__NR_io_uring_setup, 4, &p);
+    return 0;
+}
+EOT
+compile("for io_uring", $iouringCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_IO_URING} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+my $getdentsCode = <<EOT;
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+int main(int argc, char* argv[]) {
+    char buf[4096];
+    int fd = open(".", O_RDONLY|O_DIRECTORY);
+    (void)DT_UNKNOWN;
+    return syscall(SYS_getdents64, fd, buf, sizeof(buf)) <= 0;
+}
+EOT
+compile("for getdents64", $getdentsCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_GETDENTS64} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+my $inotifyCode = <<EOT;
+#include <sys/inotify.h>
+int main(int argc, char* argv[]) {
+    return inotify_init() < 0;
+}
+EOT
+compile("for inotify", $inotifyCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_INOTIFY} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+my $flockCode = <<EOT;
+#include <fcntl.h>
+#include <sys/file.h>
+int main(int argc, char* argv[]) {
+    int fd = open(argv[0], O_RDONLY);
+    return flock(fd, LOCK_EX|LOCK_NB) != 0;
+}
+EOT
+compile("for flock", $flockCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_FLOCK} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+my $spliceCode = <<EOT;
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <fcntl.h>
+int main(int argc, char* argv[]) {
+    splice(0, NULL, 1, NULL, 0, SPLICE_F_MOVE);
+    return 0;
+}
+EOT
+compile("for splice", $spliceCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_SPLICE} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+# who is at the other end of the daemon's socket; the BSDs have
+# getpeereid, Linux has SO_PEERCRED
+my $getpeereidCode = <<EOT;
+#include <sys/types.h>
+#include <unistd.h>
+int main(int argc, char* argv[]) {
+    uid_t uid;
+    gid_t gid;
+    // fd 0 needn't be a socket; linking is what counts
+    getpeereid(0, &uid, &gid);
+    return 0;
+}
+EOT
+compile("for getpeereid", $getpeereidCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_GETPEEREID} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+my $peercredCode = <<EOT;
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+int main(int argc, char* argv[]) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return 1;
+    return getsockopt(fds[0], SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0;
+}
+EOT
+compile("for SO_PEERCRED", $peercredCode, $cc, sub {
+    my ($compiles, $status) = @_;
+    $defines{HAVE_SO_PEERCRED} = ($compiles && $status == 0) ? 1 : 0;
+});
+
+# splice(2) and struct ucred are only declared for _GNU_SOURCE
+$defines{FEATURES} = ($defines{HAVE_SPLICE} || $defines{HAVE_SO_PEERCRED}) ? "#ifndef _GNU_SOURCE\n# define _GNU_SOURCE\n#endif\n" : "";
+
 my $errhCode = <<EOT;
 #include <err.h>
 #include <errno.h>
@@ -210,6 +365,8 @@ EOT
 my $systempaths = <<EOT;
 #define ETC_CONF "$etc_conf"
 #define HOME_CONF "$home_conf"
+#define HOME_CACHE "$home_cache"
+#define SHARED_CACHE "$shared_cache"
 EOT
 
 open A, ">config.h";
@@ -227,6 +384,7 @@ print A <<EOT;
 # define _BSD_SOURCE
 #endif
 
+$defines{FEATURES}
 #define VERSION "$VERSION"
 #define PREFIX "$prefix"
 
@@ -234,6 +392,15 @@ $defines{ERRH}
 
 #define HAVE_PLEDGE $defines{HAVE_PLEDGE}
 #define HAVE_UNVEIL $defines{HAVE_UNVEIL}
+#define HAVE_PTHREAD $defines{HAVE_PTHREAD}
+#define HAVE_POSIX_FADVISE $defines{HAVE_POSIX_FADVISE}
+#define HAVE_IO_URING $defines{HAVE_IO_URING}
+#define HAVE_GETDENTS64 $defines{HAVE_GETDENTS64}
+#define HAVE_INOTIFY $defines{HAVE_INOTIFY}
+#define HAVE_SPLICE $defines{HAVE_SPLICE}
+#define HAVE_FLOCK $defines{HAVE_FLOCK}
+#define HAVE_GETPEEREID $defines{HAVE_GETPEEREID}
+#define HAVE_SO_PEERCRED $defines{HAVE_SO_PEERCRED}
 
 $systempaths
 
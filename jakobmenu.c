@@ -16,152 +16,901 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <locale.h>
+#include <limits.h>
 
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
 
 #include <sys/queue.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
 
-// turn to 1 if running a mem checker or something
-#ifndef DELETE_CATEGORIES
-# define DELETE_CATEGORIES 0
+#if HAVE_PTHREAD
+# include <pthread.h>
 #endif
 
-#define OPTSTRING "hVp:a"
+#if HAVE_INOTIFY
+# include <sys/inotify.h>
+#endif
+
+#if HAVE_FLOCK
+# include <sys/file.h>
+#endif
+
+#if HAVE_IO_URING || HAVE_GETDENTS64
+# include <sys/syscall.h>
+#endif
+
+#if HAVE_IO_URING
+# include <linux/io_uring.h>
+#endif
+
+#define OPTSTRING "hVp:anj:TJi:lC:R:s:"
 
 extern char* optarg;
 extern int opterr, optind, optopt;
 
 static int useAllCategories = 0;
+static char* layoutPath = NULL;        // see Layout
+static int useCache = 1;
+static char* cachePath = NULL;
+static char* sharedCachePath = NULL;   // see Shared index
+static int indexingShared = 0;         // --shared-index
+static long numJobs = 1;
+static char* iconTheme = NULL;  // no icons unless set
+static long iconSize = 16;
+#define MAX_RECURSE 255
+static long recurseDepth = 0;   // how far below path= to look; 0: not at all
+static int lazyMenus = 0;
+static char* subMenuCommand = NULL;    // what -l's pipe menus run, sans -C
+static char* onlyCategory = NULL;      // -C
+static char* query = NULL;             // -s
+
+/*
+ * Instrumentation
+ *
+ * With -T, where the time went is reported phase by phase on exit, along
+ * with how much work was done. Everything is guarded by reportStats, so
+ * without -T all it costs is a predictable branch here and there.
+ */
+enum phase {
+    PHASE_RC,
+    PHASE_LOAD,
+    PHASE_ENUMERATE,
+    PHASE_PARSE,
+    PHASE_SORT,
+    PHASE_GRAMS,
+    PHASE_SAVE,
+    PHASE_ICONS,
+    PHASE_EXECS,
+    PHASE_RENDER,
+    PHASE_OUTPUT,
+    NPHASES
+};
+
+static const char* const phaseNames[NPHASES] = {
+    "rc", "load", "enumerate", "parse", "sort", "grams", "save", "icons", "execs", "render", "output"
+};
+
+struct timing {
+    double wall, cpu;
+};
+
+struct stats {
+    struct timing phases[NPHASES];
+    unsigned long dirs;         // path= directories read
+    unsigned long files;        // .desktop files found in them
+    unsigned long shadowed;     // skipped for a file with the same ID
+    unsigned long reused;       // files whose record was still current
+    unsigned long parsed;       // files that went through the parser
+    unsigned long hidden;       // parsed and rejected for Hidden=true,
+    unsigned long noDisplay;    // NoDisplay=true,
+    unsigned long wrongType;    // a Type other than Application,
+    unsigned long incomplete;   // or a missing Name or Exec
+    unsigned long bytes;        // read from .desktop files
+    unsigned long lines;        // parsed
+    unsigned long allocations;  // made for arenas, tables and buffers
+    unsigned long categories;   // created
+    unsigned long items;        // created
+    unsigned long shared;       // items used from the shared index
+    unsigned long icons;        // found in icon themes
+    unsigned long execs;        // found in $PATH
+    unsigned long notInstalled; // left out of the menu for their TryExec
+};
+
+static const struct {
+    const char* name;
+    size_t offset;
+} counters[] = {
+#define COUNTER(NAME) { #NAME, offsetof(struct stats, NAME) }
+    COUNTER(dirs), COUNTER(files), COUNTER(shadowed), COUNTER(reused), COUNTER(parsed),
+    COUNTER(hidden), COUNTER(noDisplay), COUNTER(wrongType), COUNTER(incomplete),
+    COUNTER(bytes), COUNTER(lines), COUNTER(allocations),
+    COUNTER(categories), COUNTER(items), COUNTER(shared), COUNTER(icons),
+    COUNTER(execs), COUNTER(notInstalled),
+#undef COUNTER
+};
+
+static int reportStats = 0; // 1 for -T, 2 for JSON (-J)
+static struct stats stats;
+
+// counters are bumped from the worker threads too
+#define COUNT(FIELD, N) do{\
+    if(reportStats) __atomic_add_fetch(&stats.FIELD, (N), __ATOMIC_RELAXED);\
+}while(0)
+
+static void timingNow(struct timing* t)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+    // includes the parser threads
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    t->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void phaseBegin(struct timing* t)
+{
+    if(reportStats) timingNow(t);
+}
+
+static void phaseEnd(enum phase phase, const struct timing* since)
+{
+    struct timing now;
+    if(!reportStats) return;
+    timingNow(&now);
+    stats.phases[phase].wall += now.wall - since->wall;
+    stats.phases[phase].cpu += now.cpu - since->cpu;
+}
+
+// writes the -T report to stderr; start is when main() started
+static void printStats(const struct timing* start)
+{
+    struct timing now;
+    timingNow(&now);
+    now.wall -= start->wall;
+    now.cpu -= start->cpu;
+
+    if(reportStats == 2) {
+        fprintf(stderr, "{\"phases\":{");
+        for(int i = 0; i < NPHASES; ++i)
+            fprintf(stderr, "\"%s\":{\"wall\":%.6f,\"cpu\":%.6f},",
+                    phaseNames[i], stats.phases[i].wall, stats.phases[i].cpu);
+        fprintf(stderr, "\"total\":{\"wall\":%.6f,\"cpu\":%.6f}},\"counters\":{",
+                now.wall, now.cpu);
+        for(size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+            fprintf(stderr, "%s\"%s\":%lu", i ? "," : "", counters[i].name,
+                    *(unsigned long*)((char*)&stats + counters[i].offset));
+        fprintf(stderr, "}}\n");
+        return;
+    }
+
+    fprintf(stderr, "%-12s %10s %10s\n", "phase", "wall ms", "cpu ms");
+    for(int i = 0; i < NPHASES; ++i)
+        fprintf(stderr, "%-12s %10.3f %10.3f\n", phaseNames[i],
+                stats.phases[i].wall * 1e3, stats.phases[i].cpu * 1e3);
+    fprintf(stderr, "%-12s %10.3f %10.3f\n", "total", now.wall * 1e3, now.cpu * 1e3);
+    for(size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+        fprintf(stderr, "%-12s %10lu\n", counters[i].name,
+                *(unsigned long*)((char*)&stats + counters[i].offset));
+}
+
+enum mode {
+    MODE_MENU = 0,  // print the menu
+    MODE_DAEMON,    // --daemon
+    MODE_CLIENT,    // --client
+    MODE_SHARED     // --shared-index
+};
 
 SLIST_HEAD(dirshead, entry) dirs;
 struct entry {
     const char* path;
+    int fd;         // open while parseAll runs, -1 otherwise
+    // path= directories have depth 0 and no prefix; their subdirectories
+    // (see recurse=) come right after them, with the prefix that makes
+    // a file name into a desktop file ID, e.g. "kde4-"
+    const char* prefix;
+    int depth;
+    int root;       // position of the path= directory this is under
+    char* names;    // .desktop files found by the walk, '\0' separated
+    size_t namesLen, namesCap;
+    // state of the directory when it was scanned; see parseAll
+    int exists;
+    int64_t mtimeSec, mtimeNsec;
     SLIST_ENTRY(entry) entries;
 };
 
-struct item {
-    char *Name, *Exec, *Category, *Icon, *Path;
-    int useTerminal;
+/*
+ * Menu model
+ *
+ * Everything parsed ends up in a handful of flat arrays which refer to
+ * each other through 32-bit offsets and indices, never pointers:
+ *
+ * strings      a single string table; offset 0 is the empty string
+ * items        one record per menu entry
+ * categories   one record per category, whose items are
+ *              members[first .. first + count)
+ * members      item indices grouped by category
+ * records      one per .desktop file found, with what parsing it
+ *              yielded, so an unchanged file is never parsed twice
+ *              (see Record store)
+ * grams        the trigrams in the items' search text, sorted, each
+ *              with the items it is in at postings[first .. first + count)
+ *              (see Search)
+ * postings     item indices grouped by trigram
+ * rules        the compiled layout= file, with ruleTable, a hash table
+ *              over it (see Layout)
+ *
+ * On top of a shared index, item indices below nbaseItems are the shared
+ * index's items and ours come after them (see Shared index).
+ *
+ * So tearing it all down is a few free()s, and the tables are written
+ * to the cache file as they are (see Menu index).
+ */
+struct arena {
+    char* base;
+    size_t len, cap;
 };
-#define INIT_ITEM(p) do{\
-    memset(p, 0, sizeof(struct item));\
-}while(0)
 
-struct item* new_item(
-        char* Name,
-        char* Exec,
-        char* Category,
-        char* Icon,
-        char* Path,
-        int useTerminal)
-{
-    struct item* rval = malloc(sizeof(struct item));
-    INIT_ITEM(rval);
-    assert(Name);
-    assert(Exec);
-    rval->Name = Name;
-    rval->Exec = Exec;
-    if(Category)
-        rval->Category = Category;
-    else
-        rval->Category = strdup("Misc");
-    if(Icon) rval->Icon = Icon;
-    if(Path) rval->Path = Path;
-    rval->useTerminal = useTerminal;
+static void arena_init(struct arena* a)
+{
+    a->cap = 4096;
+    a->base = malloc(a->cap);
+    COUNT(allocations, 1);
+    a->base[0] = '\0';
+    a->len = 1;
+}
+
+// makes room for a string of n bytes plus a terminator; never returns 0
+static uint32_t arena_alloc(struct arena* a, size_t n)
+{
+    if(a->len + n + 1 > a->cap) {
+        while(a->len + n + 1 > a->cap) a->cap *= 2;
+        a->base = realloc(a->base, a->cap);
+        COUNT(allocations, 1);
+    }
+    uint32_t rval = (uint32_t)a->len;
+    a->base[a->len + n] = '\0';
+    a->len += n + 1;
+    return rval;
+}
+
+// copies n bytes of s plus a terminator; never returns 0
+static uint32_t arena_add(struct arena* a, const char* s, size_t n)
+{
+    uint32_t rval = arena_alloc(a, n);
+    memcpy(a->base + rval, s, n);
     return rval;
 }
 
-static inline void delete_item(struct item** item)
+// offset 0 stands in for both NULL and ""
+static uint32_t arena_str(struct arena* a, const char* s)
 {
-    free((*item)->Name);
-    free((*item)->Exec);
-    free((*item)->Category);
-    free((*item)->Icon);
-    free((*item)->Path);
-    free(*item);
-    *item = NULL;
+    if(!s || !*s) return 0;
+    return arena_add(a, s, strlen(s));
 }
 
-#define DEFAULT_CAPACITY 2
-size_t ccategories = DEFAULT_CAPACITY;
+struct item {
+    uint32_t Name, Exec, Icon, Path;
+    uint32_t TryExec;   // 0 if absent; see Executables
+    uint32_t useTerminal;
+    uint32_t search;    // see searchText
+    uint32_t id;        // desktop file ID
+    uint32_t key;       // see Collation
+};
+
 struct category {
-    char* name;
-    size_t cmembers, nmembers;
-    struct item **members;
-} **categories = NULL;
-size_t ncategories = 0;
-#define INIT_CATEGORY(p) do{\
-    memset(p, 0, sizeof(struct category));\
-    p->cmembers = DEFAULT_CAPACITY;\
-    p->nmembers = 0;\
-    p->members = calloc(p->cmembers, sizeof(struct item*));\
+    uint32_t name;
+    uint32_t label;     // what its menu is called, if not name; see Layout
+    uint32_t parent;    // index + 1 of the category it is a submenu of, or 0
+    uint32_t first, count;
+};
+
+// a .desktop file, keyed by where it is and what stat(2) said about it
+struct record {
+    uint32_t dir;   // position in dirs
+    uint32_t name;  // file name within that directory
+    uint64_t ino, size;
+    int64_t mtimeSec, mtimeNsec;
+    uint32_t isOk;  // the rest is only set if the file is shown
+    uint32_t Name, Exec, Categories, Icon, Path; // Categories is 0 if absent
+    uint32_t TryExec;
+    uint32_t useTerminal;
+    uint32_t search;
+    uint32_t id;    // desktop file ID; the same as name in a path= directory
+    uint32_t key;   // Name's collation key
+};
+
+// which category an item was filed under, in the order it was found
+struct link {
+    uint32_t category, item;
+};
+
+struct gram {
+    uint32_t key;   // three bytes, the first one in bits 16-23
+    uint32_t first, count;
+};
+
+// what the layout says about one category name
+struct rule {
+    uint32_t hash;
+    uint32_t name;
+    uint32_t target;    // the rule whose category its items go in
+    uint32_t parent;    // index + 1 of the rule it is nested under, or 0
+    uint32_t label;     // Rename=, or 0
+    uint32_t rank;      // RANK_*; only the target's counts
+};
+
+static struct arena strings;
+static struct item* items = NULL;
+static uint32_t nitems = 0, citems = 0;
+static struct category* categories = NULL;
+static uint32_t ncategories = 0, ccategories = 0;
+static uint32_t* members = NULL;
+static uint32_t nmembers = 0;
+static struct record* records = NULL;
+static uint32_t nrecords = 0, crecords = 0;
+static struct link* links = NULL;
+static uint32_t nlinks = 0, clinks = 0;
+static struct gram* grams = NULL;
+static uint32_t ngrams = 0;
+static uint32_t* postings = NULL;
+static uint32_t npostings = 0;
+static const struct item* baseItems = NULL;
+static const char* baseStrtab = NULL;
+static uint32_t nbaseItems = 0;
+static int recollateBase = 0;      // its collation isn't ours
+static uint32_t* shadowed = NULL;  // base items hidden by ours, ascending
+static uint32_t nshadowed = 0;
+static struct rule* rules = NULL;
+static uint32_t nrules = 0, crules = 0;
+static uint32_t nprefixRules = 0;   // the last ones, see Layout
+static uint32_t* ruleTable = NULL;  // rule index + 1, open addressing
+static uint32_t nruleTable = 0;     // 0 or a power of 2
+static uint32_t otherRule = 0;      // index + 1 of Other=; 0 for Misc
+static int strictLayout = 0;        // there is a Main=
+
+#define STR(OFF) (strings.base + (OFF))
+
+#define APPEND(ARRAY, N, CAP, VALUE) do{\
+    if((N) >= (CAP)) {\
+        (CAP) = (CAP) ? (CAP) * 2 : 64;\
+        (ARRAY) = realloc((ARRAY), (CAP) * sizeof(*(ARRAY)));\
+        COUNT(allocations, 1);\
+    }\
+    (ARRAY)[(N)++] = (VALUE);\
+}while(0)
+
+#define ADD_MEMBER(CATEGORY, ITEM) do{\
+    struct link l_;\
+    l_.category = (CATEGORY);\
+    l_.item = (ITEM);\
+    APPEND(links, nlinks, clinks, l_);\
 }while(0)
 
-static inline void delete_category(struct category** category)
+/*
+ * Collation
+ *
+ * Items and categories are sorted the way LC_COLLATE says. Every name
+ * gets a collation key (its strxfrm(3), which compares with strcmp the
+ * way the name compares with strcoll) exactly once: an item's is kept in
+ * its record, so a name is only transformed again when its file is
+ * parsed again. Under the C locale, which would put "Zoom" before
+ * "calculator", the key is the name in lowercase, then the name itself
+ * to break ties.
+ *
+ * The sort itself works on (8-byte key prefix, key, position) triples,
+ * so most comparisons are one integer comparison, and only names which
+ * start the same get to strcmp their keys. Equal keys keep the order the
+ * items were found in.
+ */
+static const char* collation = "C";    // LC_COLLATE, as setlocale says
+static int foldCase = 1;               // C-like collation; see above
+
+// @returns the offset of name's collation key in a
+static uint32_t collationKey(struct arena* a, const char* name)
 {
-    struct item** end = (*category)->members + (*category)->nmembers;
-    for(struct item** p = (*category)->members; p != end; ++p) {
-        if(strcmp((*p)->Category, (*category)->name) == 0) {
-            delete_item(p);
-        } else {
-            *p = NULL;
-        }
+    size_t n = strlen(name);
+    if(!n) return 0;
+    if(foldCase) {
+        uint32_t key = arena_alloc(a, 2 * n + 1);
+        char* p = a->base + key;
+        for(size_t i = 0; i < n; ++i)
+            p[i] = (name[i] >= 'A' && name[i] <= 'Z') ? name[i] - 'A' + 'a' : name[i];
+        p[n] = '\x01';
+        memcpy(p + n + 1, name, n);
+        return key;
     }
-    free((*category)->name);
-    free((*category)->members);
-    free(*category);
-    *category = NULL;
+    n = strxfrm(NULL, name, 0);
+    uint32_t key = arena_alloc(a, n);
+    strxfrm(a->base + key, name, n + 1);
+    return key;
+}
+
+struct sortKey {
+    uint64_t prefix;    // the key's first 8 bytes, big-endian
+    const char* key;
+    uint32_t what, pos;
+};
+
+static inline void setSortKey(struct sortKey* k, const char* key, uint32_t what, uint32_t pos)
+{
+    uint64_t prefix = 0;
+    int i = 0;
+    for(; i < 8 && key[i]; ++i) prefix = (prefix << 8) | (unsigned char)key[i];
+    k->prefix = prefix << (8 * (8 - i));
+    k->key = key;
+    k->what = what;
+    k->pos = pos;
+}
+
+static int compare_sortKeys(const void* left, const void* right)
+{
+    const struct sortKey* l = (const struct sortKey*)left;
+    const struct sortKey* r = (const struct sortKey*)right;
+    if(l->prefix != r->prefix) return l->prefix < r->prefix ? -1 : 1;
+    int c = strcmp(l->key, r->key);
+    if(c) return c;
+    return l->pos < r->pos ? -1 : l->pos > r->pos;
+}
+
+/*
+ * Locale
+ *
+ * Name=, GenericName= and Keywords= are taken in the language
+ * LC_MESSAGES is in, matched the way the desktop entry spec says: under
+ * sr_RS.UTF-8@latin, Name[sr_RS@latin]= is best, then Name[sr_RS]=,
+ * Name[sr@latin]=, Name[sr]= and lastly Name=. The candidates are worked
+ * out once, up front, so the parser only has to compare what is between
+ * the brackets of keys it already knows.
+ *
+ * An index only has the names in one language, so each locale gets its
+ * own, next to the others (see localizedPath).
+ */
+#define MAX_LOCALES 4
+#define LOCALE_MAX 64
+
+static char locales[MAX_LOCALES][LOCALE_MAX];  // best first
+static size_t localeLens[MAX_LOCALES];
+static int nlocales = 0;                        // 0 under C
+
+static void addLocale(const char* lang, size_t langLen, const char* country, size_t countryLen, const char* modifier, size_t modifierLen)
+{
+    char* p = locales[nlocales];
+    memcpy(p, lang, langLen);
+    memcpy(p + langLen, country, countryLen);
+    memcpy(p + langLen + countryLen, modifier, modifierLen);
+    localeLens[nlocales] = langLen + countryLen + modifierLen;
+    p[localeLens[nlocales++]] = '\0';
 }
 
-int compare_categories(const void* left, const void* right)
+/**
+ * initLocale
+ *
+ * Works out the locales to look for from LC_ALL, LC_MESSAGES or LANG,
+ * whichever is set first, the way setlocale(3) would; but without
+ * needing that locale to be installed.
+ */
+static void initLocale()
 {
-    assert(left);
-    assert(right);
+    const char* const vars[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+    const char* value = NULL;
+    for(size_t i = 0; i < sizeof(vars) / sizeof(vars[0]) && !value; ++i) {
+        value = getenv(vars[i]);
+        if(value && !*value) value = NULL;
+    }
+    if(!value) return;
 
-    return strcmp((*(struct category**)left)->name, (*(struct category**)right)->name);
+    // lang_COUNTRY.ENCODING@MODIFIER, all but lang optional
+    size_t langLen = strcspn(value, "_.@");
+    const char* country = value + langLen;
+    size_t countryLen = *country == '_' ? strcspn(country, ".@") : 0;
+    const char* modifier = strchr(value, '@');
+    size_t modifierLen = modifier ? strlen(modifier) : 0;
+    if(!modifier) modifier = "";
+    if(!langLen || langLen + countryLen + modifierLen >= LOCALE_MAX) return;
+    if(strncmp(value, "C", langLen) == 0 || strncmp(value, "POSIX", langLen) == 0) return;
+    // these end up in file names
+    for(const char* s = value; *s && s != value + langLen + countryLen; ++s)
+        if(!isalnum((unsigned char)*s) && *s != '_') return;
+    for(size_t i = 1; i < modifierLen; ++i)
+        if(!isalnum((unsigned char)modifier[i]) && modifier[i] != '-') return;
+
+    if(countryLen && modifierLen)
+        addLocale(value, langLen, country, countryLen, modifier, modifierLen);
+    if(countryLen) addLocale(value, langLen, country, countryLen, "", 0);
+    if(modifierLen) addLocale(value, langLen, "", 0, modifier, modifierLen);
+    addLocale(value, langLen, "", 0, "", 0);
+}
+
+// @returns the messages locale the menu is in, "" for untranslated
+static inline const char* messagesLocale()
+{
+    return nlocales ? locales[0] : "";
 }
 
-int compare_items(const void* left, const void* right)
+// @returns which of the locales the one between a key's brackets is,
+//          MAX_LOCALES if none
+static int localeRank(const char* locale, size_t len)
 {
-    assert(left);
-    assert(right);
+    for(int i = 0; i < nlocales; ++i)
+        if(localeLens[i] == len && memcmp(locales[i], locale, len) == 0) return i;
+    return MAX_LOCALES;
+}
 
-    return strcmp((*(struct item**)left)->Name, (*(struct item**)right)->Name);
+// @returns path, for the messages locale; free it
+static char* localizedPath(const char* path)
+{
+    size_t len = strlen(path);
+    char* rval = malloc(len + 1 + LOCALE_MAX);
+    memcpy(rval, path, len + 1);
+    if(nlocales) {
+        rval[len] = '.';
+        strcpy(rval + len + 1, locales[0]);
+    }
+    return rval;
 }
 
-struct category* append_category(const char* name) 
+/*
+ * Category names are stored once, in the string table, and
+ * categoryTable is an open addressing hash table over them, so finding
+ * an item's category never scans the list.
+ */
+struct categorySlot {
+    uint32_t hash;
+    uint32_t category; // index + 1; 0 if the slot is free
+};
+static struct categorySlot* categoryTable = NULL;
+static size_t ncategoryTable = 0; // always a power of 2
+
+// FNV-1a
+static inline uint32_t hashString(const char* s)
 {
-    if(ncategories >= ccategories) {
-        ccategories *= 2;
-        categories = realloc(categories, ccategories * sizeof(struct category*));
+    uint32_t h = 2166136261u;
+    for(; *s; ++s) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
     }
-    categories[ncategories] = malloc(sizeof(struct category));
-    INIT_CATEGORY(categories[ncategories]);
-    categories[ncategories]->name = strdup(name);
-    ncategories++;
-    return categories[ncategories-1];
+    return h;
 }
 
-#define ADD_MEMBER(CATEGORY, newMember) do{\
-    if(CATEGORY->nmembers >= CATEGORY->cmembers) {\
-        CATEGORY->cmembers *= 2;\
-        CATEGORY->members = realloc(CATEGORY->members, CATEGORY->cmembers * sizeof(struct item*));\
-    }\
-    CATEGORY->members[CATEGORY->nmembers++] = newMember;\
-}while(0)
+static inline uint32_t hashBytes(const char* s, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
 
-static inline struct category* get_category(const char* category)
+// name is len bytes long, and need not be terminated
+static struct categorySlot* find_category_slot(const char* name, size_t len, uint32_t hash)
 {
-    for(int i = 0; i < ncategories; ++i) {
-        if(strcmp(categories[i]->name, category) == 0) {
-            return categories[i];
-        }
+    size_t mask = ncategoryTable - 1;
+    for(size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct categorySlot* slot = &categoryTable[i];
+        if(!slot->category) return slot;
+        const char* other = STR(categories[slot->category - 1].name);
+        if(slot->hash == hash && strncmp(other, name, len) == 0 && other[len] == '\0')
+            return slot;
+    }
+}
+
+static void grow_category_table()
+{
+    struct categorySlot* old = categoryTable;
+    size_t nold = ncategoryTable;
+    ncategoryTable = nold ? nold * 2 : 64;
+    categoryTable = calloc(ncategoryTable, sizeof(struct categorySlot));
+    for(size_t i = 0; i < nold; ++i) {
+        if(!old[i].category) continue;
+        const char* name = STR(categories[old[i].category - 1].name);
+        *find_category_slot(name, strlen(name), old[i].hash) = old[i];
+    }
+    free(old);
+}
+
+// name is the offset of a terminated string of len bytes
+static uint32_t append_category(uint32_t name, size_t len, uint32_t hash)
+{
+    // keep the load factor under 1/2
+    if(2 * (ncategories + 1) > ncategoryTable) grow_category_table();
+
+    struct category c;
+    memset(&c, 0, sizeof(c));
+    c.name = name;
+    APPEND(categories, ncategories, ccategories, c);
+    COUNT(categories, 1);
+
+    struct categorySlot* slot = find_category_slot(STR(name), len, hash);
+    assert(!slot->category);
+    slot->hash = hash;
+    slot->category = ncategories;
+
+    return ncategories - 1;
+}
+
+// @returns the index of the category, or append_category(category)
+static inline uint32_t get_category(const char* category)
+{
+    size_t len = strlen(category);
+    uint32_t hash = hashBytes(category, len);
+    if(ncategoryTable) {
+        struct categorySlot* slot = find_category_slot(category, len, hash);
+        if(slot->category) return slot->category - 1;
+    }
+    return append_category(arena_add(&strings, category, len), len, hash);
+}
+
+/**
+ * get_category_at
+ *
+ * Like get_category, for the len bytes at offset name of the string
+ * table, which need not be terminated there. Only copies them if the
+ * category is new and they aren't.
+ */
+static uint32_t get_category_at(uint32_t name, size_t len)
+{
+    uint32_t hash = hashBytes(STR(name), len);
+    if(ncategoryTable) {
+        struct categorySlot* slot = find_category_slot(STR(name), len, hash);
+        if(slot->category) return slot->category - 1;
+    }
+    if(STR(name)[len] != '\0') {
+        // the copy may move the string table, so copy from where it is then
+        uint32_t copy = arena_alloc(&strings, len);
+        memcpy(STR(copy), STR(name), len);
+        name = copy;
+    }
+    return append_category(name, len, hash);
+}
+
+/**
+ * groupMembers
+ *
+ * Turns the links into per-category ranges of members. This is a
+ * counting sort, so items keep the order they were found in.
+ */
+static void groupMembers()
+{
+    free(members);
+    nmembers = nlinks;
+    members = malloc((nmembers ? nmembers : 1) * sizeof(uint32_t));
+    for(uint32_t i = 0; i < ncategories; ++i)
+        categories[i].count = 0;
+    for(uint32_t i = 0; i < nlinks; ++i)
+        categories[links[i].category].count++;
+    uint32_t first = 0;
+    for(uint32_t i = 0; i < ncategories; ++i) {
+        categories[i].first = first;
+        first += categories[i].count;
+        categories[i].count = 0;
+    }
+    for(uint32_t i = 0; i < nlinks; ++i) {
+        struct category* c = &categories[links[i].category];
+        members[c->first + c->count++] = links[i].item;
+    }
+    free(links);
+    links = NULL;
+    nlinks = clinks = 0;
+    // category indices are about to change
+    free(categoryTable);
+    categoryTable = NULL;
+    ncategoryTable = 0;
+}
+
+/*
+ * Category pool
+ *
+ * Sorting a category's items and rendering them needs nothing from the
+ * other categories, so with numJobs > 1 big menus spread categories over
+ * as many threads: each takes the next one, biggest first, until none
+ * are left. Every category's result goes to its own place, so the
+ * outcome never depends on which thread did what.
+ */
+struct categoryPool {
+    void (*task)(void* ctx, uint32_t category);
+    void* ctx;
+    uint32_t* order;
+    uint32_t n;
+    uint32_t next;  // first in order not taken yet
+};
+
+static const struct category* poolCategories;   // for compare_poolOrder
+
+static int compare_poolOrder(const void* left, const void* right)
+{
+    uint32_t l = poolCategories[*(const uint32_t*)left].count;
+    uint32_t r = poolCategories[*(const uint32_t*)right].count;
+    if(l != r) return l > r ? -1 : 1;
+    return *(const uint32_t*)left < *(const uint32_t*)right ? -1 : 1;
+}
+
+static void* categoryWorker(void* arg)
+{
+    struct categoryPool* pool = (struct categoryPool*)arg;
+    for(;;) {
+        uint32_t i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if(i >= pool->n) break;
+        pool->task(pool->ctx, pool->order[i]);
     }
     return NULL;
 }
 
+/**
+ * forEachCategory
+ *
+ * Calls task(ctx, i) for each of the n categories, in parallel if asked
+ * to and there is more than one job.
+ */
+static void forEachCategory(const struct category* categories, uint32_t n,
+        void (*task)(void* ctx, uint32_t category), void* ctx, int parallel)
+{
+    struct categoryPool pool;
+    pool.task = task;
+    pool.ctx = ctx;
+    pool.n = n;
+    pool.next = 0;
+    pool.order = malloc((n ? n : 1) * sizeof(uint32_t));
+    for(uint32_t i = 0; i < n; ++i) pool.order[i] = i;
+
+    long nthreads = parallel ? numJobs : 1;
+    if(nthreads > (long)n) nthreads = n;
+#if HAVE_PTHREAD
+    if(nthreads > 1) {
+        // the big ones first, so nobody is left with one at the end
+        poolCategories = categories;
+        qsort(pool.order, n, sizeof(uint32_t), &compare_poolOrder);
+        pthread_t* threads = calloc(nthreads, sizeof(pthread_t));
+        long started = 0;
+        for(long i = 1; i < nthreads; ++i) {
+            if(pthread_create(&threads[i], NULL, &categoryWorker, &pool) != 0) break;
+            started = i;
+        }
+        categoryWorker(&pool);
+        for(long i = 1; i <= started; ++i)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    } else
+#endif
+    {
+        categoryWorker(&pool);
+    }
+    free(pool.order);
+}
+
+// below this many members, threads cost more than they save
+#define PARALLEL_SORT_MIN 4096
+
+struct sortJob {
+    const char* keys;       // where keyOf points
+    const uint32_t* keyOf;  // keys of the shared items, if recollated
+};
+
+static void sortCategory(void* ctx, uint32_t i)
+{
+    const struct sortJob* job = (const struct sortJob*)ctx;
+    uint32_t* m = members + categories[i].first;
+    uint32_t count = categories[i].count;
+    struct sortKey* sorted = malloc((count ? count : 1) * sizeof(struct sortKey));
+    COUNT(allocations, 1);
+    for(uint32_t j = 0; j < count; ++j) {
+        const char* key;
+        if(m[j] >= nbaseItems) key = STR(items[m[j] - nbaseItems].key);
+        else if(job->keyOf) key = job->keys + job->keyOf[m[j]];
+        else key = baseStrtab + baseItems[m[j]].key;
+        setSortKey(&sorted[j], key, m[j], j);
+    }
+    qsort(sorted, count, sizeof(struct sortKey), &compare_sortKeys);
+    for(uint32_t j = 0; j < count; ++j)
+        m[j] = sorted[j].what;
+    free(sorted);
+}
+
+/**
+ * sortModel
+ *
+ * Groups the members by category, and sorts the categories and each
+ * one's items by name (see Collation).
+ */
+static void sortModel()
+{
+    groupMembers();
+
+    // categories are few, and their keys are made on the spot, from
+    // what their menus are called
+    struct arena keys;
+    arena_init(&keys);
+    uint32_t* keyOf = malloc((ncategories ? ncategories : 1) * sizeof(uint32_t));
+    for(uint32_t i = 0; i < ncategories; ++i)
+        keyOf[i] = collationKey(&keys, STR(categories[i].label ? categories[i].label : categories[i].name));
+    struct sortKey* sorted = malloc((ncategories ? ncategories : 1) * sizeof(struct sortKey));
+    COUNT(allocations, 3);
+    for(uint32_t i = 0; i < ncategories; ++i)
+        setSortKey(&sorted[i], keys.base + keyOf[i], i, i);
+    qsort(sorted, ncategories, sizeof(struct sortKey), &compare_sortKeys);
+    struct category* byName = malloc((ccategories ? ccategories : 1) * sizeof(struct category));
+    for(uint32_t i = 0; i < ncategories; ++i)
+        byName[i] = categories[sorted[i].what];
+    // the submenus have to follow their parents; keyOf is done with,
+    // so it can say where each category went
+    for(uint32_t i = 0; i < ncategories; ++i)
+        keyOf[sorted[i].what] = i;
+    for(uint32_t i = 0; i < ncategories; ++i)
+        if(byName[i].parent) byName[i].parent = keyOf[byName[i].parent - 1] + 1;
+    free(categories);
+    categories = byName;
+    free(sorted);
+
+    // a shared index made under another locale has the wrong keys
+    keys.len = 1;
+    free(keyOf);
+    keyOf = NULL;
+    if(nbaseItems && recollateBase) {
+        keyOf = malloc(nbaseItems * sizeof(uint32_t));
+        for(uint32_t i = 0; i < nbaseItems; ++i)
+            keyOf[i] = collationKey(&keys, baseStrtab + baseItems[i].Name);
+    }
+
+    struct sortJob job;
+    job.keys = keys.base;
+    job.keyOf = keyOf;
+    forEachCategory(categories, ncategories, &sortCategory, &job, nmembers >= PARALLEL_SORT_MIN);
+    free(keyOf);
+    free(keys.base);
+}
+
+static void freeModel()
+{
+    free(strings.base);
+    free(items);
+    free(categories);
+    free(members);
+    free(records);
+    free(links);
+    free(grams);
+    free(postings);
+    free(shadowed);
+    free(rules);
+    free(ruleTable);
+    free(categoryTable);
+    memset(&strings, 0, sizeof(strings));
+    items = NULL;
+    categories = NULL;
+    members = NULL;
+    records = NULL;
+    links = NULL;
+    grams = NULL;
+    postings = NULL;
+    categoryTable = NULL;
+    nitems = citems = ncategories = ccategories = nmembers = nlinks = clinks = 0;
+    nrecords = crecords = 0;
+    ngrams = npostings = 0;
+    baseItems = NULL;
+    baseStrtab = NULL;
+    recollateBase = 0;
+    shadowed = NULL;
+    nbaseItems = nshadowed = 0;
+    rules = NULL;
+    ruleTable = NULL;
+    nrules = crules = nprefixRules = nruleTable = otherRule = 0;
+    strictLayout = 0;
+    ncategoryTable = 0;
+}
+
 
 static char* menuId = "jakobmenu-1";
 static char* menuTitle = "jakobmenu";
@@ -211,13 +960,30 @@ static char* expand(const char* path)
 static void addPath(const char* path)
 {
     assert(path);
+    // the shared index only has what every user has: the paths before
+    // the first one in a home directory (see Shared index)
+    static int sawHome = 0;
+    if(indexingShared && (sawHome || path[0] == '~')) {
+        sawHome = 1;
+        return;
+    }
     char* expandedPath = expand(path);
     struct entry* e = (struct entry*)malloc(sizeof(struct entry));
     memset(e, 0, sizeof(struct entry));
     e->path = expandedPath;
+    e->fd = -1;
+    e->prefix = "";
     SLIST_INSERT_HEAD(&dirs, e, entries);
 }
 
+static void freeEntry(struct entry* e)
+{
+    free((char*)e->path);
+    if(e->depth) free((char*)e->prefix);
+    free(e->names);
+    free(e);
+}
+
 /**
  * splitByEquals
  *
@@ -337,6 +1103,75 @@ static void parseRC(const char* path)
                 }
                 int logicalValue = atoi(value);
                 useAllCategories = logicalValue != 0;
+            } else if(strcmp(key, "cache") == 0) {
+                assert(value);
+                if(strlen(value) == 0) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected value\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                free(cachePath);
+                cachePath = expand(value);
+                free(line);
+                continue;
+            } else if(strcmp(key, "layout") == 0) {
+                assert(value);
+                if(strlen(value) == 0) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected value\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                free(layoutPath);
+                layoutPath = expand(value);
+                free(line);
+                continue;
+            } else if(strcmp(key, "sharedCache") == 0) {
+                assert(value);
+                if(strlen(value) == 0) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected value\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                free(sharedCachePath);
+                sharedCachePath = expand(value);
+                free(line);
+                continue;
+            } else if(strcmp(key, "iconTheme") == 0) {
+                assert(value);
+                if(strlen(value) == 0) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected value\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                free(iconTheme);
+                iconTheme = strdup(value);
+                free(line);
+                continue;
+            } else if(strcmp(key, "iconSize") == 0) {
+                assert(value);
+                long size = atol(value);
+                if(size < 1) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected a size\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                iconSize = size;
+                free(line);
+                continue;
+            } else if(strcmp(key, "lazyMenus") == 0) {
+                assert(value);
+                if(strlen(value) == 0) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected value\n", expandedPath, lineNo);
+                    goto end2;
+                }
+                lazyMenus = atoi(value) != 0;
+                free(line);
+                continue;
+            } else if(strcmp(key, "recurse") == 0) {
+                assert(value);
+                long depth = atol(value);
+                if(strlen(value) == 0 || depth < 0 || depth > MAX_RECURSE) {
+                    fprintf(stderr, "Invalid syntax in file %s line %d: expected a depth up to %d\n", expandedPath, lineNo, MAX_RECURSE);
+                    goto end2;
+                }
+                recurseDepth = depth;
+                free(line);
+                continue;
             } else {
                 free(line);
                 fprintf(stderr, "Invalid syntax in file %s line %d\n",
@@ -364,183 +1199,4681 @@ static int sectionType(const char* line)
     return 2;
 }
 
-static void parseDotDesktop(const char* path)
-{
-    FILE* f = fopen(path, "r");
-    if(!f)
-        return;
+/*
+ * Directory enumeration
+ *
+ * Each path= directory is opened once and its entries are read in bulk,
+ * with getdents64(2) where we have it. Entries are picked by their
+ * .desktop suffix and d_type alone; the directory fd stays open and the
+ * files are later opened relative to it, so no full path is ever put
+ * together.
+ */
+#define DIR_BUFFER 32768
 
-    // information extracted from a .desktop file
-    char *Name = NULL, *Exec = NULL, *Icon = NULL;
-    char *Categories = NULL, *Path = NULL;
-    int isOk = 1, useTerminal = 0;
-    // isOk will be set to 0 if it's something we shouldn't/can't show
+struct dirScan {
+    int fd;
+#if HAVE_GETDENTS64
+    char* buf;
+    size_t pos, len;
+#else
+    DIR* dir;
+#endif
+};
+
+#if HAVE_GETDENTS64
+// what getdents64(2) returns; not every libc declares it
+struct kernel_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static int dirScanOpen(struct dirScan* ds, int fd)
+{
+    memset(ds, 0, sizeof(struct dirScan));
+    ds->fd = fd;
+#if HAVE_GETDENTS64
+    ds->buf = malloc(DIR_BUFFER);
+    return 1;
+#else
+    // fdopendir(3) takes over the fd it's given, and we keep using ours
+    int copy = dup(fd);
+    if(copy < 0) return 0;
+    ds->dir = fdopendir(copy);
+    if(!ds->dir) {
+        close(copy);
+        return 0;
+    }
+    return 1;
+#endif
+}
+
+static void dirScanClose(struct dirScan* ds)
+{
+#if HAVE_GETDENTS64
+    free(ds->buf);
+#else
+    closedir(ds->dir);
+#endif
+    memset(ds, 0, sizeof(struct dirScan));
+}
+
+/**
+ * dirScanNext
+ *
+ * @returns the name of the next entry in the directory other than . and
+ *          .., or NULL when there are no more; the name is valid until
+ *          the next call
+ */
+static const char* dirScanNext(struct dirScan* ds, size_t* namelen, unsigned char* type)
+{
+    for(;;) {
+        const char* name;
+#if HAVE_GETDENTS64
+        if(ds->pos >= ds->len) {
+            long n = syscall(SYS_getdents64, ds->fd, ds->buf, DIR_BUFFER);
+            if(n <= 0) return NULL;
+            ds->pos = 0;
+            ds->len = (size_t)n;
+        }
+        const struct kernel_dirent64* de = (const struct kernel_dirent64*)(ds->buf + ds->pos);
+        ds->pos += de->d_reclen;
+#else
+        const struct dirent* de = readdir(ds->dir);
+        if(!de) return NULL;
+#endif
+        name = de->d_name;
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        *type = de->d_type;
+        *namelen = strlen(name);
+        return name;
+    }
+}
+
+// symlinks and whatever the filesystem won't say get stat()ed later anyway
+static inline int mayBeFile(unsigned char type)
+{
+    return type == DT_REG || type == DT_LNK || type == DT_UNKNOWN;
+}
+
+static inline int hasSuffix(const char* name, size_t len, const char* suffix, size_t suffixLen)
+{
+    return len > suffixLen && memcmp(name + len - suffixLen, suffix, suffixLen) == 0;
+}
+
+/*
+ * Directory walker
+ *
+ * parseAll starts with a walk which lists every path= directory once and
+ * keeps the names of the .desktop files in it. With recurse= (or -R) the
+ * subdirectories down to that depth are walked too, and as XDG says,
+ * applications/kde4/foo.desktop gets the desktop file ID
+ * kde4-foo.desktop. Every directory is a job of its own: the
+ * subdirectories one turns up are queued for whichever thread is free,
+ * so separate subtrees are listed at the same time and a deep one holds
+ * up no one but itself. Symlinks to directories are followed, so each
+ * path= directory keeps a set of the directories found under it, and
+ * none is listed twice; a link back up the tree would otherwise have
+ * the walk go round in circles until recurse= runs out.
+ */
+
+// a directory under the path= directory root, as stat(2) knows it
+struct visit {
+    uint64_t dev, ino;
+    int root;
+    int used;
+};
+
+struct walk {
+    struct entry** queue;   // directories still to be listed
+    size_t nqueue, cqueue;
+    struct entry** found;   // every subdirectory, in no particular order
+    size_t nfound, cfound;
+    size_t busy;            // directories being listed right now
+    struct visit* visited;  // a hash table of the directories found
+    size_t nvisited, cvisited;
+    time_t scanStart;
+    int serial;
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+static void addName(struct entry* e, const char* name, size_t len)
+{
+    if(e->namesLen + len + 1 > e->namesCap) {
+        while(e->namesLen + len + 1 > e->namesCap)
+            e->namesCap = e->namesCap ? 2 * e->namesCap : 1024;
+        e->names = realloc(e->names, e->namesCap);
+        COUNT(allocations, 1);
+    }
+    memcpy(e->names + e->namesLen, name, len + 1);
+    e->namesLen += len + 1;
+}
+
+static struct entry* newSubdir(const struct entry* parent, const char* name, size_t len)
+{
+    struct entry* e = calloc(1, sizeof(struct entry));
+    char* path = malloc(strlen(parent->path) + len + 2);
+    char* prefix = malloc(strlen(parent->prefix) + len + 2);
+    sprintf(path, "%s/%s", parent->path, name);
+    sprintf(prefix, "%s%s-", parent->prefix, name);
+    e->path = path;
+    e->prefix = prefix;
+    e->fd = -1;
+    e->depth = parent->depth + 1;
+    e->root = parent->root;
+    return e;
+}
+
+static struct visit* findVisit(struct visit* table, size_t size, uint64_t dev, uint64_t ino, int root)
+{
+    size_t mask = size - 1;
+    uint64_t hash = (ino * 0x9E3779B97F4A7C15ull) ^ (dev * 0xC2B2AE3D27D4EB4Full) ^ (uint64_t)root;
+    for(size_t i = (size_t)(hash ^ (hash >> 29)) & mask;; i = (i + 1) & mask) {
+        struct visit* v = &table[i];
+        if(!v->used || (v->dev == dev && v->ino == ino && v->root == root)) return v;
+    }
+}
+
+// @returns 1 if the directory st is about wasn't found under root yet,
+//          which it now is
+static int firstVisit(struct walk* w, int root, const struct stat* st)
+{
+#if HAVE_PTHREAD
+    if(!w->serial) pthread_mutex_lock(&w->lock);
+#endif
+    // keep the load factor under 1/2
+    if(2 * (w->nvisited + 1) > w->cvisited) {
+        size_t size = w->cvisited ? 2 * w->cvisited : 64;
+        struct visit* table = calloc(size, sizeof(struct visit));
+        for(size_t i = 0; i < w->cvisited; ++i) {
+            const struct visit* v = &w->visited[i];
+            if(v->used) *findVisit(table, size, v->dev, v->ino, v->root) = *v;
+        }
+        free(w->visited);
+        w->visited = table;
+        w->cvisited = size;
+    }
+    struct visit* v = findVisit(w->visited, w->cvisited, st->st_dev, st->st_ino, root);
+    int first = !v->used;
+    if(first) {
+        v->dev = st->st_dev;
+        v->ino = st->st_ino;
+        v->root = root;
+        v->used = 1;
+        w->nvisited++;
+    }
+#if HAVE_PTHREAD
+    if(!w->serial) pthread_mutex_unlock(&w->lock);
+#endif
+    return first;
+}
+
+/**
+ * walkDir
+ *
+ * Lists e, adding its .desktop files to e->names and its subdirectories
+ * (if e is not as deep as it gets) to subdirs.
+ */
+static void walkDir(struct walk* w, struct entry* e,
+        struct entry*** subdirs, size_t* nsubdirs, size_t* csubdirs)
+{
+    static const char suffix[] = ".desktop";
+    struct dirScan scan;
+    struct stat st;
+    const char* name;
+    size_t namelen;
+    unsigned char type;
+
+    e->exists = 0;
+    e->mtimeSec = e->mtimeNsec = 0;
+    e->fd = open(e->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(e->fd < 0) return;
+    COUNT(dirs, 1);
+    // remember what the directory looked like *before* we read it;
+    // anything touched after this point will invalidate the index
+    if(fstat(e->fd, &st) == 0) {
+        e->exists = 1;
+        e->mtimeSec = st.st_mtim.tv_sec;
+        e->mtimeNsec = st.st_mtim.tv_nsec;
+        // a directory modified in the same second we scanned it may
+        // change again without its mtime moving on coarse filesystems
+        if(st.st_mtim.tv_sec >= w->scanStart) e->mtimeSec = -1;
+        // so no link leads back to it
+        if(!e->depth) firstVisit(w, e->root, &st);
+    }
+    if(!dirScanOpen(&scan, e->fd)) return;
+    while((name = dirScanNext(&scan, &namelen, &type)) != NULL) {
+        if(mayBeFile(type) && hasSuffix(name, namelen, suffix, sizeof(suffix) - 1)) {
+            addName(e, name, namelen);
+            continue;
+        }
+        if(e->depth >= recurseDepth) continue;
+        if(type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN) continue;
+        if(fstatat(e->fd, name, &st, 0) != 0 || !S_ISDIR(st.st_mode)) continue;
+        if(!firstVisit(w, e->root, &st)) continue;
+        APPEND(*subdirs, *nsubdirs, *csubdirs, newSubdir(e, name, namelen));
+    }
+    dirScanClose(&scan);
+    // parseFiles only needs the directories with files in them
+    if(!e->namesLen) {
+        close(e->fd);
+        e->fd = -1;
+    }
+}
+
+static void* walkWorker(void* arg)
+{
+    struct walk* w = (struct walk*)arg;
+    struct entry** subdirs = NULL;
+    size_t nsubdirs = 0, csubdirs = 0;
+    for(;;) {
+        struct entry* e;
+#if HAVE_PTHREAD
+        if(!w->serial) pthread_mutex_lock(&w->lock);
+        while(!w->serial && !w->nqueue && w->busy)
+            pthread_cond_wait(&w->cond, &w->lock);
+#endif
+        if(!w->nqueue) {
+#if HAVE_PTHREAD
+            if(!w->serial) pthread_mutex_unlock(&w->lock);
+#endif
+            break;
+        }
+        e = w->queue[--w->nqueue];
+        w->busy++;
+#if HAVE_PTHREAD
+        if(!w->serial) pthread_mutex_unlock(&w->lock);
+#endif
+
+        nsubdirs = 0;
+        walkDir(w, e, &subdirs, &nsubdirs, &csubdirs);
+
+#if HAVE_PTHREAD
+        if(!w->serial) pthread_mutex_lock(&w->lock);
+#endif
+        for(size_t i = 0; i < nsubdirs; ++i) {
+            APPEND(w->queue, w->nqueue, w->cqueue, subdirs[i]);
+            APPEND(w->found, w->nfound, w->cfound, subdirs[i]);
+        }
+        w->busy--;
+#if HAVE_PTHREAD
+        if(!w->serial) {
+            // this thread takes one of the subdirectories itself; wake
+            // someone up for each of the others, or everyone if that was
+            // the last of it
+            if(!w->nqueue && !w->busy)
+                pthread_cond_broadcast(&w->cond);
+            for(size_t i = 1; i < nsubdirs; ++i)
+                pthread_cond_signal(&w->cond);
+            pthread_mutex_unlock(&w->lock);
+        }
+#endif
+    }
+    free(subdirs);
+    return NULL;
+}
+
+static int compare_subdirs(const void* left, const void* right)
+{
+    const struct entry* l = *(const struct entry* const*)left;
+    const struct entry* r = *(const struct entry* const*)right;
+    if(l->root != r->root) return l->root < r->root ? -1 : 1;
+    return strcmp(l->path, r->path);
+}
+
+/**
+ * walkDirs
+ *
+ * Lists the path= directories, and their subdirectories if so
+ * configured, which then follow their path= directory in dirs.
+ */
+static void walkDirs(time_t scanStart)
+{
+    struct walk w;
+    memset(&w, 0, sizeof(w));
+    w.scanStart = scanStart;
+
+    // the subdirectories of the last walk are looked for again
+    struct entry** link = &SLIST_FIRST(&dirs);
+    int nroots = 0;
+    while(*link) {
+        struct entry* np = *link;
+        if(np->depth) {
+            *link = SLIST_NEXT(np, entries);
+            freeEntry(np);
+            continue;
+        }
+        np->root = nroots++;
+        np->namesLen = 0;
+        APPEND(w.queue, w.nqueue, w.cqueue, np);
+        link = &SLIST_NEXT(np, entries);
+    }
+
+    // without subdirectories there is too little to go around
+    long nthreads = recurseDepth > 0 ? numJobs : 1;
+    w.serial = nthreads <= 1;
+#if HAVE_PTHREAD
+    if(!w.serial) {
+        pthread_t* threads = calloc(nthreads, sizeof(pthread_t));
+        long started = 0;
+        pthread_mutex_init(&w.lock, NULL);
+        pthread_cond_init(&w.cond, NULL);
+        for(long i = 1; i < nthreads; ++i) {
+            if(pthread_create(&threads[i], NULL, &walkWorker, &w) != 0) break;
+            started = i;
+        }
+        walkWorker(&w);
+        for(long i = 1; i <= started; ++i)
+            pthread_join(threads[i], NULL);
+        pthread_cond_destroy(&w.cond);
+        pthread_mutex_destroy(&w.lock);
+        free(threads);
+    } else
+#endif
+    {
+        w.serial = 1;
+        walkWorker(&w);
+    }
+
+    // put each subtree after its path= directory, in a stable order
+    qsort(w.found, w.nfound, sizeof(struct entry*), &compare_subdirs);
+    size_t i = 0;
+    struct entry* np = SLIST_FIRST(&dirs);
+    while(np) {
+        struct entry* next = SLIST_NEXT(np, entries);
+        struct entry* last = np;
+        for(; i < w.nfound && w.found[i]->root == np->root; ++i) {
+            SLIST_INSERT_AFTER(last, w.found[i], entries);
+            last = w.found[i];
+        }
+        np = next;
+    }
+    free(w.queue);
+    free(w.found);
+    free(w.visited);
+}
+
+/*
+ * File loading
+ *
+ * Files are not opened by the parsers one at a time. A loader walks the
+ * list of files in windows and gets as much of a window's I/O in flight
+ * at once as it can: with io_uring the opens and the reads of a whole
+ * window are each submitted as a single batch;
+ * otherwise every file in the window is opened and posix_fadvise()d so
+ * the kernel reads them ahead while the parsers pread() them.
+ */
+struct dfile {
+    int dirfd;      // the file is name in this directory
+    const char* name;
+    size_t size;    // what stat(2) said when the directory was listed
+    int fd;         // if not -1, the rest of the file is read from here
+    char* buf;      // what was read so far, cap + 1 bytes big
+    size_t len, cap;
+    int complete;   // buf holds the whole file and is '\0' terminated
+};
+
+#define LOAD_WINDOW 128
+
+/**
+ * readRest
+ *
+ * Finishes loading f with pread(2), picking up wherever the loader left
+ * off; opens the file first if the loader did not.
+ *
+ * @returns 1 if f is now complete, 0 if the file could not be read
+ */
+static int readRest(struct dfile* f)
+{
+    if(f->complete) return 1;
+
+    if(f->fd < 0) {
+        f->fd = openat(f->dirfd, f->name, O_RDONLY|O_CLOEXEC);
+        if(f->fd < 0) return 0;
+    }
+    if(!f->buf) {
+        // the size is only a hint, keep reading until EOF
+        f->cap = f->size > 0 ? f->size + 1 : 4096;
+        f->buf = malloc(f->cap + 1);
+        f->len = 0;
+        COUNT(allocations, 1);
+    }
+    for(;;) {
+        if(f->len == f->cap) {
+            f->cap *= 2;
+            f->buf = realloc(f->buf, f->cap + 1);
+            COUNT(allocations, 1);
+        }
+        ssize_t rd = pread(f->fd, f->buf + f->len, f->cap - f->len, f->len);
+        if(rd < 0) {
+            if(errno == EINTR) continue;
+            free(f->buf);
+            f->buf = NULL;
+            close(f->fd);
+            f->fd = -1;
+            return 0;
+        }
+        if(rd == 0) break;
+        f->len += rd;
+    }
+    close(f->fd);
+    f->fd = -1;
+
+    f->buf[f->len] = '\0';
+    f->complete = 1;
+    return 1;
+}
+
+/**
+ * loadWindowAdvise
+ *
+ * Fallback loader: opens the files and tells the kernel we will need
+ * them, so their reads overlap instead of happening one after another.
+ */
+static void loadWindowAdvise(struct dfile* files, size_t n)
+{
+#if HAVE_POSIX_FADVISE
+    for(size_t i = 0; i < n; ++i) {
+        files[i].fd = openat(files[i].dirfd, files[i].name, O_RDONLY|O_CLOEXEC);
+        if(files[i].fd >= 0)
+            posix_fadvise(files[i].fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+#endif
+}
+
+#if HAVE_IO_URING
+/*
+ * A minimal io_uring driver on top of the raw system calls, so we don't
+ * need liburing. Kernels which lack io_uring, or an opcode we use, make
+ * us fall back to loadWindowAdvise / readRest.
+ */
+struct uring {
+    int fd;
+    unsigned entries;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe* sqes;
+    struct io_uring_cqe* cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned pending; // prepared but not yet submitted
+};
+
+static int uringInit(struct uring* r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(r, 0, sizeof(struct uring));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(r->fd < 0) return 0;
+
+    r->entries = p.sq_entries;
+    r->sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(r->cqRingSize > r->sqRingSize) r->sqRingSize = r->cqRingSize;
+        r->cqRingSize = r->sqRingSize;
+    }
+    r->sqRing = mmap(NULL, r->sqRingSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if(r->sqRing == MAP_FAILED) goto fail1;
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqRing = r->sqRing;
+    } else {
+        r->cqRing = mmap(NULL, r->cqRingSize, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if(r->cqRing == MAP_FAILED) goto fail2;
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED) goto fail3;
+
+    r->sqHead = (unsigned*)((char*)r->sqRing + p.sq_off.head);
+    r->sqTail = (unsigned*)((char*)r->sqRing + p.sq_off.tail);
+    r->sqMask = (unsigned*)((char*)r->sqRing + p.sq_off.ring_mask);
+    r->sqArray = (unsigned*)((char*)r->sqRing + p.sq_off.array);
+    r->cqHead = (unsigned*)((char*)r->cqRing + p.cq_off.head);
+    r->cqTail = (unsigned*)((char*)r->cqRing + p.cq_off.tail);
+    r->cqMask = (unsigned*)((char*)r->cqRing + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)((char*)r->cqRing + p.cq_off.cqes);
+    return 1;
+
+fail3:
+    if(r->cqRing != r->sqRing) munmap(r->cqRing, r->cqRingSize);
+fail2:
+    munmap(r->sqRing, r->sqRingSize);
+fail1:
+    close(r->fd);
+    r->fd = -1;
+    return 0;
+}
+
+static void uringClose(struct uring* r)
+{
+    if(r->fd < 0) return;
+    munmap(r->sqes, r->sqesSize);
+    if(r->cqRing != r->sqRing) munmap(r->cqRing, r->cqRingSize);
+    munmap(r->sqRing, r->sqRingSize);
+    close(r->fd);
+    r->fd = -1;
+}
+
+// the caller makes sure no more than r->entries are prepared at once
+static struct io_uring_sqe* uringSqe(struct uring* r, uint64_t userData)
+{
+    unsigned tail = *r->sqTail + r->pending;
+    unsigned slot = tail & *r->sqMask;
+    struct io_uring_sqe* sqe = &r->sqes[slot];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = userData;
+    r->sqArray[slot] = slot;
+    r->pending++;
+    return sqe;
+}
+
+/**
+ * uringRun
+ *
+ * Submits everything prepared with uringSqe and waits for all of it to
+ * complete, handing each completion to onComplete.
+ *
+ * @returns 1 on success, 0 if the ring broke down
+ */
+static int uringRun(struct uring* r,
+        void (*onComplete)(void* ctx, uint64_t userData, int res),
+        void* ctx)
+{
+    unsigned toSubmit = r->pending;
+    unsigned toComplete = r->pending;
+    __atomic_store_n(r->sqTail, *r->sqTail + r->pending, __ATOMIC_RELEASE);
+    r->pending = 0;
+
+    while(toComplete > 0) {
+        int n = (int)syscall(__NR_io_uring_enter, r->fd, toSubmit, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        if(n < 0) {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            return 0;
+        }
+        toSubmit -= (unsigned)n;
+
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        for(; head != tail; ++head) {
+            struct io_uring_cqe* cqe = &r->cqes[head & *r->cqMask];
+            onComplete(ctx, cqe->user_data, cqe->res);
+            toComplete--;
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+static void onOpen(void* ctx, uint64_t userData, int res)
+{
+    struct dfile* f = &((struct dfile*)ctx)[userData];
+    f->fd = res < 0 ? -1 : res;
+}
+
+static void onRead(void* ctx, uint64_t userData, int res)
+{
+    struct dfile* f = &((struct dfile*)ctx)[userData];
+    if(res < 0) {
+        // let readRest start over
+        free(f->buf);
+        f->buf = NULL;
+        return;
+    }
+    f->len = res;
+    if(f->len < f->cap) {
+        // short read on a regular file: that was all of it
+        f->buf[f->len] = '\0';
+        f->complete = 1;
+        close(f->fd);
+        f->fd = -1;
+    }
+}
+
+/**
+ * loadWindowUring
+ *
+ * Opens and reads n files with two io_uring round trips.
+ * n must be at most the ring size.
+ *
+ * @returns 0 if the ring is unusable from now on
+ */
+static int loadWindowUring(struct uring* r, struct dfile* files, size_t n)
+{
+    for(size_t i = 0; i < n; ++i) {
+        struct io_uring_sqe* sqe = uringSqe(r, i);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = files[i].dirfd;
+        sqe->addr = (uint64_t)(uintptr_t)files[i].name;
+        sqe->open_flags = O_RDONLY|O_CLOEXEC;
+    }
+    if(!uringRun(r, &onOpen, files)) return 0;
+
+    for(size_t i = 0; i < n; ++i) {
+        struct dfile* f = &files[i];
+        if(f->fd < 0) continue;
+        f->cap = f->size > 0 ? f->size + 1 : 4096;
+        if(f->cap > (1u << 30)) f->cap = 1u << 30;
+        f->buf = malloc(f->cap + 1);
+        f->len = 0;
+        COUNT(allocations, 1);
+
+        struct io_uring_sqe* sqe = uringSqe(r, i);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = f->fd;
+        sqe->addr = (uint64_t)(uintptr_t)f->buf;
+        sqe->len = (uint32_t)f->cap;
+        sqe->off = 0;
+    }
+    if(!uringRun(r, &onRead, files)) {
+        // the buffers may still be written to; leak them
+        for(size_t i = 0; i < n; ++i) files[i].buf = NULL;
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+/**
+ * splitLine
+ *
+ * Like splitByEquals, but for a line whose end is already known.
+ * key and value point into the line, which gets '\0's written into it.
+ *
+ * line     first character of the line
+ * end      one past the last character; *end must be '\0'
+ * keyLen   receives strlen(*key)
+ * @returns 1 if there was an =, 0 if it couldn't parse
+ */
+static int splitLine(char* line, char* end, char** key, size_t* keyLen, char** value)
+{
+    char* equals = memchr(line, '=', end - line);
+
+    if(!equals)
+        return 0;
+
+    char* valueTail = end;
+    *value = equals + 1;
+    while(**value && isspace(**value))
+        (*value)++;
+    while(valueTail > *value && isspace(*(valueTail - 1)))
+        --valueTail;
+    *valueTail = '\0';
+
+    *key = line;
+    while(*key < equals && isspace(**key))
+        (*key)++;
+    while(equals > *key && isspace(*(equals - 1)))
+        --equals;
+    *equals = '\0';
+    *keyLen = equals - *key;
+
+    return 1;
+}
+
+enum desktopKey {
+    KEY_OTHER = 0,
+    KEY_TYPE,
+    KEY_HIDDEN,
+    KEY_NODISPLAY,
+    KEY_NAME,
+    KEY_ICON,
+    KEY_EXEC,
+    KEY_CATEGORIES,
+    KEY_PATH,
+    KEY_TERMINAL,
+    KEY_GENERICNAME,
+    KEY_KEYWORDS,
+    KEY_TRYEXEC
+};
+
+/**
+ * desktopKey
+ *
+ * Identifies the [Desktop Entry] keys we care about. The (length, first
+ * byte) pair already tells them all apart, so most lines, which tend to
+ * be Name[xx]= and friends, are rejected without comparing any strings.
+ * Those are picked out by localizedKey instead.
+ */
+static enum desktopKey desktopKey(const char* key, size_t len)
+{
+#define KEY_IS(S, K) (memcmp(key, S, sizeof(S) - 1) == 0 ? K : KEY_OTHER)
+    switch(len) {
+        case 4:
+            switch(key[0]) {
+                case 'T': return KEY_IS("Type", KEY_TYPE);
+                case 'N': return KEY_IS("Name", KEY_NAME);
+                case 'I': return KEY_IS("Icon", KEY_ICON);
+                case 'E': return KEY_IS("Exec", KEY_EXEC);
+                case 'P': return KEY_IS("Path", KEY_PATH);
+            }
+            break;
+        case 6:
+            if(key[0] == 'H') return KEY_IS("Hidden", KEY_HIDDEN);
+            break;
+        case 7:
+            if(key[0] == 'T') return KEY_IS("TryExec", KEY_TRYEXEC);
+            break;
+        case 8:
+            if(key[0] == 'T') return KEY_IS("Terminal", KEY_TERMINAL);
+            if(key[0] == 'K') return KEY_IS("Keywords", KEY_KEYWORDS);
+            break;
+        case 9:
+            if(key[0] == 'N') return KEY_IS("NoDisplay", KEY_NODISPLAY);
+            break;
+        case 10:
+            if(key[0] == 'C') return KEY_IS("Categories", KEY_CATEGORIES);
+            break;
+        case 11:
+            if(key[0] == 'G') return KEY_IS("GenericName", KEY_GENERICNAME);
+            break;
+    }
+    return KEY_OTHER;
+#undef KEY_IS
+}
+
+/**
+ * localizedKey
+ *
+ * Identifies Name[xx]= and the other keys we take translated, if xx is
+ * one of our locales (see Locale); *rank is set to how good a match it
+ * is.
+ */
+static enum desktopKey localizedKey(const char* key, size_t len, int* rank)
+{
+    const char* bracket = memchr(key, '[', len);
+    if(!bracket) return KEY_OTHER;
+    enum desktopKey k = desktopKey(key, bracket - key);
+    if(k != KEY_NAME && k != KEY_GENERICNAME && k != KEY_KEYWORDS) return KEY_OTHER;
+    *rank = localeRank(bracket + 1, key + len - 1 - (bracket + 1));
+    return *rank < MAX_LOCALES ? k : KEY_OTHER;
+}
+
+// takes value for a translated field, unless it has a better one already
+static inline void takeLocalized(char** field, int* fieldRank, char* value, int rank)
+{
+    if(rank > *fieldRank) return;
+    *field = value;
+    *fieldRank = rank;
+}
+
+/**
+ * struct desktop
+ *
+ * What parseDotDesktop extracted from one file. Filled in by the parser
+ * threads and copied into records by keepDesktop on the main thread.
+ * The strings are offsets into the parser thread's own arena.
+ */
+enum reject {
+    REJECT_NONE = 0,
+    REJECT_HIDDEN,      // Hidden=true
+    REJECT_NODISPLAY,   // NoDisplay=true
+    REJECT_TYPE,        // not an Application
+    REJECT_INCOMPLETE   // no Name or no Exec
+};
+
+struct desktop {
+    struct arena* strings;
+    uint32_t Name, Exec, Categories, Icon, Path; // Categories: 0 if absent
+    uint32_t TryExec;
+    uint32_t search;
+    int useTerminal;
+    int isOk;
+    enum reject rejected;   // why it isn't ok
+    uint32_t lines;         // how many lines were looked at
+};
+
+// past this, Exec= lines are environment and arguments nobody searches for
+#define SEARCH_FIELD_MAX 256
+
+/**
+ * searchText
+ *
+ * Puts together what -s looks through: the fields, one per line and
+ * with ASCII lowercased, so the search can be case insensitive by just
+ * lowercasing the query.
+ */
+static uint32_t searchText(struct arena* arena, const char* const* fields, size_t nfields)
+{
+    size_t len = 0;
+    for(size_t i = 0; i < nfields; ++i)
+        len += (fields[i] ? strnlen(fields[i], SEARCH_FIELD_MAX) : 0) + 1;
+    uint32_t rval = arena_alloc(arena, len - 1);
+    char* p = arena->base + rval;
+    for(size_t i = 0; i < nfields; ++i) {
+        size_t n = fields[i] ? strnlen(fields[i], SEARCH_FIELD_MAX) : 0;
+        for(size_t j = 0; j < n; ++j) {
+            char c = fields[i][j];
+            *p++ = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+        }
+        if(i + 1 < nfields) *p++ = '\n';
+    }
+    return rval;
+}
+
+/**
+ * parseDotDesktop
+ *
+ * Parses a loaded file into d. This function only touches its arguments,
+ * so it can run on any thread.
+ *
+ * buf      the contents of the file; buf[len] must be '\0'
+ * len      the size of the file
+ * d        receives the result
+ * arena    where the strings worth keeping are copied to
+ */
+static void parseDotDesktop(char* buf, size_t len, struct desktop* d, struct arena* arena)
+{
+    memset(d, 0, sizeof(struct desktop));
+    char* const bufEnd = buf + len;
+
+    // information extracted from a .desktop file;
+    // these point into buf until we know the entry is worth keeping
+    char *Name = NULL, *Exec = NULL, *Icon = NULL;
+    char *Categories = NULL, *Path = NULL, *TryExec = NULL;
+    char *GenericName = NULL, *Keywords = NULL;
+    // how well the translations of those match; see Locale
+    int NameRank = MAX_LOCALES + 1, GenericNameRank = MAX_LOCALES + 1;
+    int KeywordsRank = MAX_LOCALES + 1;
+    int useTerminal = 0;
+    uint32_t lines = 0;
+    // set if it's something we shouldn't/can't show
+    enum reject rejected = REJECT_NONE;
+
+    // state machine:
+    // 0 - ignore everything until [Desktop Entry] is encountered
+    // 1 - extract Name, Exec etc
+    // 2 - different section, ignore
+    int foundDesktopEntry = 0;
+
+    char* next = NULL;
+    for(char* line = buf; line < bufEnd && foundDesktopEntry < 2; line = next) {
+        char* eol = memchr(line, '\n', bufEnd - line);
+        if(!eol) eol = bufEnd;
+        next = eol + 1;
+        ++lines;
+        // comment -- ignore everything until end of line
+        char* comment = memchr(line, '#', eol - line);
+        if(comment) eol = comment;
+        // add terminator
+        *eol = '\0';
+
+        // see foundDesktopEntry
+        switch(sectionType(line)) {
+            default:
+            case 0:
+                break;
+            case 1:
+                foundDesktopEntry = 1;
+                break;
+            case 2:
+                if(foundDesktopEntry) {
+                    foundDesktopEntry = 2;
+                }
+                break;
+        }
+
+        // parse statements
+        char *key = NULL, *value = NULL;
+        size_t keyLen = 0;
+        if(foundDesktopEntry != 1 || !splitLine(line, eol, &key, &keyLen, &value))
+            continue;
+
+        // the untranslated value is worse than any translation
+        int rank = MAX_LOCALES;
+        enum desktopKey k = nlocales && keyLen && key[keyLen - 1] == ']'
+            ? localizedKey(key, keyLen, &rank)
+            : desktopKey(key, keyLen);
+        switch(k) {
+            case KEY_OTHER:
+                break;
+            case KEY_TYPE:
+                if(strcmp(value, "Application") != 0) rejected = REJECT_TYPE;
+                break;
+            case KEY_HIDDEN:
+                if(strcmp(value, "true") == 0) rejected = REJECT_HIDDEN;
+                break;
+            case KEY_NODISPLAY:
+                if(strcmp(value, "true") == 0) rejected = REJECT_NODISPLAY;
+                break;
+            case KEY_NAME:
+                takeLocalized(&Name, &NameRank, value, rank);
+                break;
+            case KEY_ICON:
+                Icon = value;
+                break;
+            case KEY_EXEC: {
+                char* ss = NULL;
+                Exec = value;
+                // strip %U, %u, %f, openbox cannot provide that
+                while((ss = strchr(ss ? ss : Exec, '%')) != NULL) {
+                    if(ss[1] == 'U' || ss[1] == 'u' || ss[1] == 'F' || ss[1] == 'f') {
+                        ss[0] = ' ';
+                        ss[1] = ' ';
+                    }
+                    ++ss;
+                }
+                break;
+            }
+            case KEY_CATEGORIES:
+                Categories = value;
+                break;
+            case KEY_PATH:
+                Path = value;
+                break;
+            case KEY_TERMINAL:
+                useTerminal = (strcmp(value, "true") == 0);
+                break;
+            case KEY_GENERICNAME:
+                takeLocalized(&GenericName, &GenericNameRank, value, rank);
+                break;
+            case KEY_KEYWORDS:
+                takeLocalized(&Keywords, &KeywordsRank, value, rank);
+                break;
+            case KEY_TRYEXEC:
+                TryExec = value;
+                break;
+        }
+
+        // we won't show it, don't bother reading the rest
+        if(rejected) break;
+    }
+
+    // if we're ok and we have at least Name and Exec...
+    if(!rejected && !(Name && Exec)) rejected = REJECT_INCOMPLETE;
+    d->rejected = rejected;
+    d->lines = lines;
+
+    if(!rejected) {
+        // only now copy out what we keep
+        d->strings = arena;
+        d->Name = arena_str(arena, Name);
+        d->Exec = arena_str(arena, Exec);
+        d->Categories = Categories ? arena_add(arena, Categories, strlen(Categories)) : 0;
+        d->Icon = arena_str(arena, Icon);
+        d->Path = arena_str(arena, Path);
+        d->TryExec = arena_str(arena, TryExec);
+        const char* const fields[] = { Name, GenericName, Keywords, Exec };
+        d->search = searchText(arena, fields, sizeof(fields) / sizeof(fields[0]));
+        d->useTerminal = useTerminal;
+        d->isOk = 1;
+    }
+}
+
+/**
+ * keepDesktop
+ *
+ * Copies what was parsed out of a file into its record.
+ */
+static void keepDesktop(struct record* r, const struct desktop* d)
+{
+    COUNT(lines, d->lines);
+    switch(d->rejected) {
+        case REJECT_NONE: break;
+        case REJECT_HIDDEN: COUNT(hidden, 1); break;
+        case REJECT_NODISPLAY: COUNT(noDisplay, 1); break;
+        case REJECT_TYPE: COUNT(wrongType, 1); break;
+        case REJECT_INCOMPLETE: COUNT(incomplete, 1); break;
+    }
+    r->isOk = d->isOk;
+    if(!d->isOk) return;
+    const char* src = d->strings->base;
+    r->Name = arena_str(&strings, src + d->Name);
+    r->Exec = arena_str(&strings, src + d->Exec);
+    r->Categories = d->Categories
+        ? arena_add(&strings, src + d->Categories, strlen(src + d->Categories))
+        : 0;
+    r->Icon = arena_str(&strings, src + d->Icon);
+    r->Path = arena_str(&strings, src + d->Path);
+    r->TryExec = arena_str(&strings, src + d->TryExec);
+    r->search = arena_str(&strings, src + d->search);
+    r->key = collationKey(&strings, src + d->Name);
+    r->useTerminal = d->useTerminal;
+}
+
+/*
+ * Layout
+ *
+ * Without layout=, an item goes under the first category in its
+ * Categories= (or under all of them, with -a), and every category is a
+ * menu of its own. A layout file, in the same key=value form as a
+ * .desktop file, says how to do better:
+ *
+ *  Main=AudioVideo;Development;...  the top-level menus; once there is a
+ *                                   Main=, other categories aren't used
+ *  Nest.System=Emulator;Monitor     makes those submenus of System
+ *  Merge.AudioVideo=Audio;Video     puts their items in AudioVideo
+ *  Rename.AudioVideo=Multimedia     is what AudioVideo's menu is called
+ *  Exclude=GTK;Qt;X-*               are never used; a final * matches
+ *                                   anything
+ *  Other=Other                      gets what has nowhere else to go,
+ *                                   instead of Misc
+ *
+ * An item goes under the most specific category it has: a submenu, then
+ * a main category, then one the layout doesn't know, the first of those
+ * it lists.
+ *
+ * The file is compiled into rules, one per category name in it, which
+ * already say where items go, with merges and nesting followed to the
+ * end; ruleTable is a hash table over them. So placing an item takes a
+ * lookup per category it lists. The rules are saved in the menu index,
+ * with the file's mtime, and a rebuild takes them from there rather than
+ * compiling the file again, unless it changed.
+ */
+enum {
+    RANK_EXCLUDED = 0,
+    RANK_UNKNOWN,       // not in the layout
+    RANK_MAIN,
+    RANK_NESTED
+};
+
+// what stat(2) said about layoutPath when it was compiled
+static int layoutExists = 0;
+static int64_t layoutMtimeSec = 0, layoutMtimeNsec = 0;
+
+// name is len bytes long, and need not be terminated
+static uint32_t* findRuleSlot(const char* name, size_t len, uint32_t hash)
+{
+    uint32_t mask = nruleTable - 1;
+    for(uint32_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t* slot = &ruleTable[i];
+        if(!*slot) return slot;
+        const char* other = STR(rules[*slot - 1].name);
+        if(rules[*slot - 1].hash == hash && strncmp(other, name, len) == 0 && other[len] == '\0')
+            return slot;
+    }
+}
+
+static inline const struct rule* findRule(const char* name, size_t len)
+{
+    if(!nruleTable) return NULL;
+    uint32_t slot = *findRuleSlot(name, len, hashBytes(name, len));
+    return slot ? &rules[slot - 1] : NULL;
+}
+
+// @returns the rule for name, made anew if it has none yet
+static uint32_t ruleFor(const char* name)
+{
+    size_t len = strlen(name);
+    uint32_t hash = hashBytes(name, len);
+    // keep the load factor under 1/2
+    if(2 * (nrules + 1) > nruleTable) {
+        uint32_t* old = ruleTable;
+        uint32_t nold = nruleTable;
+        nruleTable = nold ? nold * 2 : 64;
+        ruleTable = calloc(nruleTable, sizeof(uint32_t));
+        for(uint32_t i = 0; i < nold; ++i) {
+            if(!old[i]) continue;
+            const struct rule* r = &rules[old[i] - 1];
+            *findRuleSlot(STR(r->name), strlen(STR(r->name)), r->hash) = old[i];
+        }
+        free(old);
+    }
+    uint32_t* slot = findRuleSlot(name, len, hash);
+    if(*slot) return *slot - 1;
+
+    struct rule r;
+    memset(&r, 0, sizeof(r));
+    r.hash = hash;
+    r.name = arena_add(&strings, name, len);
+    r.target = nrules;
+    r.rank = RANK_MAIN;
+    APPEND(rules, nrules, crules, r);
+    *slot = nrules;
+    return nrules - 1;
+}
+
+// calls fn(ctx, name) for each name in a ;-separated list
+static void forEachName(char* list, void (*fn)(void* ctx, const char* name), void* ctx)
+{
+    char* save = NULL;
+    for(char* name = strtok_r(list, ";", &save); name; name = strtok_r(NULL, ";", &save)) {
+        while(isspace(*name)) ++name;
+        char* end = name + strlen(name);
+        while(end > name && isspace(end[-1])) --end;
+        *end = '\0';
+        if(*name) fn(ctx, name);
+    }
+}
+
+struct layoutLine {
+    enum { LAYOUT_MAIN, LAYOUT_NEST, LAYOUT_MERGE, LAYOUT_EXCLUDE } what;
+    uint32_t rule;      // Nest.RULE= or Merge.RULE=
+    struct rule* prefixes;
+    uint32_t nprefixes, cprefixes;
+};
+
+static void addToLayout(void* ctx, const char* name)
+{
+    struct layoutLine* l = (struct layoutLine*)ctx;
+    size_t len = strlen(name);
+    if(l->what == LAYOUT_EXCLUDE && name[len - 1] == '*') {
+        struct rule prefix;
+        memset(&prefix, 0, sizeof(prefix));
+        prefix.name = arena_add(&strings, name, len - 1);
+        prefix.rank = RANK_EXCLUDED;
+        APPEND(l->prefixes, l->nprefixes, l->cprefixes, prefix);
+        return;
+    }
+    uint32_t rule = ruleFor(name);
+    switch(l->what) {
+        case LAYOUT_MAIN: break;
+        case LAYOUT_NEST: rules[rule].parent = l->rule + 1; break;
+        case LAYOUT_MERGE: rules[rule].target = l->rule; break;
+        case LAYOUT_EXCLUDE: rules[rule].rank = RANK_EXCLUDED; break;
+    }
+}
+
+/**
+ * compileLayout
+ *
+ * Reads the layout= file into rules.
+ */
+static void compileLayout()
+{
+    time_t start = time(NULL);
+    struct stat st;
+    layoutExists = stat(layoutPath, &st) == 0;
+    layoutMtimeSec = layoutMtimeNsec = 0;
+    if(layoutExists) {
+        layoutMtimeSec = st.st_mtim.tv_sec;
+        layoutMtimeNsec = st.st_mtim.tv_nsec;
+        // see parseAll
+        if(st.st_mtim.tv_sec >= start) layoutMtimeSec = -1;
+    }
+    struct dfile f;
+    memset(&f, 0, sizeof(f));
+    f.dirfd = AT_FDCWD;
+    f.name = layoutPath;
+    f.fd = -1;
+    if(!layoutExists || !readRest(&f)) {
+        warn("Failed to read %s", layoutPath);
+        return;
+    }
+
+    struct layoutLine l;
+    memset(&l, 0, sizeof(l));
+    int lineNo = 0;
+    char* end = f.buf + f.len;
+    for(char* line = f.buf, *next; line < end; line = next) {
+        char* eol = memchr(line, '\n', end - line);
+        if(!eol) eol = end;
+        next = eol + 1;
+        *eol = '\0';
+        ++lineNo;
+        while(line < eol && isspace(*line)) ++line;
+        if(!*line || *line == '#') continue;
+        char *key, *value;
+        size_t keyLen;
+        if(!splitLine(line, eol, &key, &keyLen, &value)) {
+            fprintf(stderr, "Invalid syntax in file %s line %d\n", layoutPath, lineNo);
+            continue;
+        }
+        // Nest.System= and the like name a category after the dot
+        char* arg = memchr(key, '.', keyLen);
+        if(arg) *arg++ = '\0';
+        if(arg && !*arg) arg = NULL;
+
+        if(strcmp(key, "Main") == 0 && !arg) {
+            strictLayout = 1;
+            l.what = LAYOUT_MAIN;
+        } else if(strcmp(key, "Nest") == 0 && arg) {
+            l.what = LAYOUT_NEST;
+            l.rule = ruleFor(arg);
+        } else if(strcmp(key, "Merge") == 0 && arg) {
+            l.what = LAYOUT_MERGE;
+            l.rule = ruleFor(arg);
+        } else if(strcmp(key, "Exclude") == 0 && !arg) {
+            l.what = LAYOUT_EXCLUDE;
+        } else if(strcmp(key, "Rename") == 0 && arg) {
+            uint32_t rule = ruleFor(arg);
+            rules[rule].label = arena_str(&strings, value);
+            continue;
+        } else if(strcmp(key, "Other") == 0 && !arg && *value) {
+            otherRule = ruleFor(value) + 1;
+            continue;
+        } else {
+            fprintf(stderr, "Unknown key in file %s line %d\n", layoutPath, lineNo);
+            continue;
+        }
+        forEachName(value, &addToLayout, &l);
+    }
+    free(f.buf);
+
+    // follow merges to the end, so placing an item never has to
+    for(uint32_t i = 0; i < nrules; ++i) {
+        uint32_t target = rules[i].target;
+        for(uint32_t n = 0; rules[target].target != target && n < nrules; ++n)
+            target = rules[target].target;
+        if(rules[target].target != target) {
+            fprintf(stderr, "Merge loop at %s in %s\n", STR(rules[i].name), layoutPath);
+            target = i;
+        }
+        rules[i].target = target;
+    }
+    // a submenu of a merged category is one of what it was merged into
+    for(uint32_t i = 0; i < nrules; ++i)
+        if(rules[i].parent) rules[i].parent = rules[rules[i].parent - 1].target + 1;
+    for(uint32_t i = 0; i < nrules; ++i) {
+        uint32_t parent = rules[i].parent;
+        for(uint32_t n = 0; parent && parent - 1 != i && n < nrules; ++n)
+            parent = rules[parent - 1].parent;
+        if(parent && parent - 1 == i) {
+            fprintf(stderr, "Nest loop at %s in %s\n", STR(rules[i].name), layoutPath);
+            rules[i].parent = 0;
+        }
+    }
+    for(uint32_t i = 0; i < nrules; ++i)
+        if(rules[i].rank != RANK_EXCLUDED)
+            rules[i].rank = rules[i].parent ? RANK_NESTED : RANK_MAIN;
+    if(otherRule) otherRule = rules[otherRule - 1].target + 1;
+
+    // the prefixes can't be hashed, so they go last, out of ruleTable
+    for(uint32_t i = 0; i < l.nprefixes; ++i) {
+        l.prefixes[i].target = nrules;
+        APPEND(rules, nrules, crules, l.prefixes[i]);
+    }
+    nprefixRules = l.nprefixes;
+    free(l.prefixes);
+}
+
+/**
+ * ruleCategory
+ *
+ * @returns the category of rule, made (under its parent, with its label)
+ *          if there isn't one yet
+ */
+static uint32_t ruleCategory(uint32_t rule)
+{
+    uint32_t old = ncategories;
+    uint32_t category = get_category_at(rules[rule].name, strlen(STR(rules[rule].name)));
+    if(ncategories == old) return category;
+    categories[category].label = rules[rule].label;
+    if(rules[rule].parent) {
+        uint32_t parent = ruleCategory(rules[rule].parent - 1);
+        categories[category].parent = parent + 1;
+    }
+    return category;
+}
+
+// @returns the category called name, as the layout has it
+static uint32_t namedCategory(const char* name)
+{
+    const struct rule* r = findRule(name, strlen(name));
+    return r ? ruleCategory(r - rules) : get_category(name);
+}
+
+// where an item that lists the category at offset name goes
+struct place {
+    uint32_t rank;
+    uint32_t rule;      // if known
+    uint32_t name;      // if not
+    size_t len;
+};
+
+static void findPlace(struct place* p, uint32_t name, size_t len, int first)
+{
+    const char* s = STR(name);
+    const struct rule* r = len ? findRule(s, len) : NULL;
+    p->rank = RANK_EXCLUDED;
+    if(r) {
+        if(r->rank == RANK_EXCLUDED) return;
+        p->rule = r->target;
+        p->rank = rules[r->target].rank;
+        return;
+    }
+    if(!len || strictLayout) return;
+    for(uint32_t i = nrules - nprefixRules; i < nrules; ++i) {
+        const char* prefix = STR(rules[i].name);
+        if(strncmp(s, prefix, strlen(prefix)) == 0) return;
+    }
+    // -a never used these
+    if(!first && (strncmp(s, "X-", 2) == 0 || strncmp(s, "x-", 2) == 0)) return;
+    p->rank = RANK_UNKNOWN;
+    p->name = name;
+    p->len = len;
+}
+
+static uint32_t placeCategory(const struct place* p)
+{
+    return p->rank == RANK_UNKNOWN ? get_category_at(p->name, p->len) : ruleCategory(p->rule);
+}
+
+/**
+ * addRecord
+ *
+ * Creates a menu item out of a file's record and files it under its
+ * categories.
+ */
+static void addRecord(const struct record* r)
+{
+    if(!r->isOk) return;
+
+    // create a menu item
+    struct item item;
+    item.Name = r->Name;
+    item.Exec = r->Exec;
+    item.Icon = r->Icon;
+    item.Path = r->Path;
+    item.TryExec = r->TryExec;
+    item.useTerminal = r->useTerminal;
+    item.search = r->search;
+    item.id = r->id;
+    item.key = r->key;
+    APPEND(items, nitems, citems, item);
+    COUNT(items, 1);
+    uint32_t self = nbaseItems + nitems - 1;
+
+    // Categories= is walked where it is, by offset, since making
+    // categories may move the string table
+    uint32_t firstLink = nlinks;
+    struct place best;
+    best.rank = RANK_EXCLUDED;
+    for(uint32_t name = r->Categories, first = 1; name; first = 0) {
+        size_t len = strcspn(STR(name), ";");
+        struct place p;
+        findPlace(&p, name, len, first);
+        name = STR(name)[len] ? name + len + 1 : 0;
+        if(p.rank == RANK_EXCLUDED) continue;
+        if(!useAllCategories) {
+            if(p.rank > best.rank) best = p;
+            continue;
+        }
+        // two of them may well end up in the same place
+        uint32_t category = placeCategory(&p);
+        uint32_t i = firstLink;
+        while(i < nlinks && links[i].category != category) ++i;
+        if(i == nlinks) ADD_MEMBER(category, self);
+    }
+    if(best.rank != RANK_EXCLUDED) ADD_MEMBER(placeCategory(&best), self);
+    if(nlinks == firstLink)
+        ADD_MEMBER(otherRule ? ruleCategory(otherRule - 1) : get_category("Misc"), self);
+}
+
+/*
+ * Parser pool
+ *
+ * parseAll() first lists every .desktop file that needs parsing. The
+ * main thread then runs the loader over that list while numJobs - 1
+ * threads pull batches of loaded files off it and parse each into its
+ * own slot of results; once everything is loaded the main thread joins
+ * in parsing. Each thread keeps what it parsed in its own arena. The
+ * slots are copied into their records on the main thread, and the menu
+ * is built from the records in the order the files were found, so it is
+ * exactly the same as after a serial run.
+ */
+struct parseJob {
+    struct dfile* files;
+    struct desktop* results;
+    size_t nfiles;
+    size_t next;    // first file not yet claimed by a parser
+    size_t loaded;  // files before this went through the loader
+    int serial;     // don't wait for the loader, it's our own thread
+#if HAVE_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+};
+
+struct parser {
+    struct parseJob* job;
+    struct arena strings;
+};
+
+#define PARSE_BATCH 16
+
+static void* parseWorker(void* arg)
+{
+    struct parser* parser = (struct parser*)arg;
+    struct parseJob* job = parser->job;
+    for(;;) {
+        size_t first, last;
+#if HAVE_PTHREAD
+        if(!job->serial) {
+            pthread_mutex_lock(&job->lock);
+            while(job->next >= job->loaded && job->loaded < job->nfiles)
+                pthread_cond_wait(&job->cond, &job->lock);
+        }
+#endif
+        first = job->next;
+        last = first + PARSE_BATCH < job->loaded ? first + PARSE_BATCH : job->loaded;
+        job->next = last;
+#if HAVE_PTHREAD
+        if(!job->serial) {
+            // let the loader know it may run ahead again
+            pthread_cond_broadcast(&job->cond);
+            pthread_mutex_unlock(&job->lock);
+        }
+#endif
+        if(first >= last) break;
+        for(size_t i = first; i < last; ++i) {
+            struct dfile* f = &job->files[i];
+            if(readRest(f)) {
+                COUNT(bytes, f->len);
+                parseDotDesktop(f->buf, f->len, &job->results[i], &parser->strings);
+            }
+            free(f->buf);
+            f->buf = NULL;
+        }
+    }
+    return NULL;
+}
+
+static void loadFiles(struct parser* parser)
+{
+    struct parseJob* job = parser->job;
+#if HAVE_IO_URING
+    struct uring ring;
+    int haveRing = uringInit(&ring, LOAD_WINDOW) && ring.entries >= LOAD_WINDOW;
+#endif
+    while(job->loaded < job->nfiles) {
+        size_t first = job->loaded;
+        size_t n = job->nfiles - first;
+        if(n > LOAD_WINDOW) n = LOAD_WINDOW;
+
+#if HAVE_PTHREAD
+        if(!job->serial) {
+            // don't read everything into memory before it is parsed
+            pthread_mutex_lock(&job->lock);
+            while(job->loaded - job->next > 2 * LOAD_WINDOW)
+                pthread_cond_wait(&job->cond, &job->lock);
+            pthread_mutex_unlock(&job->lock);
+        }
+#endif
+
+#if HAVE_IO_URING
+        if(haveRing && !loadWindowUring(&ring, job->files + first, n)) {
+            uringClose(&ring);
+            haveRing = 0;
+        }
+        if(!haveRing)
+#endif
+        loadWindowAdvise(job->files + first, n);
+
+#if HAVE_PTHREAD
+        if(!job->serial) {
+            pthread_mutex_lock(&job->lock);
+            job->loaded = first + n;
+            pthread_cond_broadcast(&job->cond);
+            pthread_mutex_unlock(&job->lock);
+            continue;
+        }
+#endif
+        job->loaded = first + n;
+        parseWorker(parser);
+    }
+#if HAVE_IO_URING
+    if(haveRing) uringClose(&ring);
+#endif
+}
+
+/**
+ * parseFiles
+ *
+ * Parses the files of records[slots[i]] into those records. dirFds holds
+ * the open path= directories. Names are taken straight out of the
+ * string table, which nothing adds to until all the parsing is done.
+ */
+static void parseFiles(const int* dirFds, const uint32_t* slots, size_t npaths)
+{
+    struct parseJob job;
+    memset(&job, 0, sizeof(job));
+    job.nfiles = npaths;
+    job.files = calloc(npaths ? npaths : 1, sizeof(struct dfile));
+    job.results = calloc(npaths ? npaths : 1, sizeof(struct desktop));
+    for(size_t i = 0; i < npaths; ++i) {
+        const struct record* r = &records[slots[i]];
+        job.files[i].dirfd = dirFds[r->dir];
+        job.files[i].name = STR(r->name);
+        job.files[i].size = r->size;
+        job.files[i].fd = -1;
+    }
+
+    long nthreads = numJobs;
+    if(nthreads > (long)(npaths / PARSE_BATCH)) nthreads = npaths / PARSE_BATCH;
+    if(nthreads < 1) nthreads = 1;
+    job.serial = nthreads <= 1;
+    // the main thread is parser number 0
+    struct parser* parsers = calloc(nthreads, sizeof(struct parser));
+    for(long i = 0; i < nthreads; ++i) {
+        parsers[i].job = &job;
+        arena_init(&parsers[i].strings);
+    }
+#if HAVE_PTHREAD
+    if(!job.serial) {
+        pthread_t* threads = calloc(nthreads, sizeof(pthread_t));
+        long started = 0;
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.cond, NULL);
+        for(long i = 1; i < nthreads; ++i) {
+            if(pthread_create(&threads[i], NULL, &parseWorker, &parsers[i]) != 0) break;
+            started = i;
+        }
+        loadFiles(&parsers[0]);
+        parseWorker(&parsers[0]);
+        for(long i = 1; i <= started; ++i)
+            pthread_join(threads[i], NULL);
+        pthread_cond_destroy(&job.cond);
+        pthread_mutex_destroy(&job.lock);
+        free(threads);
+    } else
+#endif
+    {
+        loadFiles(&parsers[0]);
+    }
+
+    for(size_t i = 0; i < npaths; ++i)
+        keepDesktop(&records[slots[i]], &job.results[i]);
+    for(long i = 0; i < nthreads; ++i)
+        free(parsers[i].strings.base);
+    free(parsers);
+    free(job.results);
+    free(job.files);
+}
+
+/*
+ * Menu index
+ *
+ * The sorted model is saved to the cache file as it is in memory: a
+ * header, the directory table, and then the records, items, categories,
+ * members, grams, postings, shadowed, rules, ruleTable and strings tables
+ * unchanged, each 8-byte aligned. A later run mmaps
+ * the file and renders straight from it, so with a fresh cache no
+ * .desktop file is ever opened.
+ *
+ * Freshness is decided by the mtimes of the path= directories (and of
+ * their subdirectories, with recurse=), which change whenever a .desktop
+ * file is added, removed or renamed into place (package managers always
+ * do the latter). When they did change, the records let the rebuild skip
+ * every file that didn't. The layout= file is checked the same way.
+ */
+#define INDEX_MAGIC "jakobidx"
+#define INDEX_VERSION 10
+#define INDEX_ALLCATEGORIES 0x1
+#define INDEX_OVERLAY 0x2
+#define INDEX_RECURSE(DEPTH) ((uint32_t)(DEPTH) << 8)
+
+struct index_dir {
+    uint32_t path;
+    uint32_t exists;
+    int64_t mtimeSec, mtimeNsec;
+    uint32_t depth;     // 0 for path= directories
+    uint32_t reserved;
+};
+
+struct index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t size;
+    uint32_t ndirs, dirsOffset;
+    uint32_t nrecords, recordsOffset;
+    uint32_t nitems, itemsOffset;
+    uint32_t ncategories, categoriesOffset;
+    uint32_t nmembers, membersOffset;
+    uint32_t ngrams, gramsOffset;
+    uint32_t npostings, postingsOffset;
+    uint32_t nshadowed, shadowedOffset;
+    uint32_t nrules, rulesOffset;
+    uint32_t nruleTable, ruleTableOffset;
+    uint32_t strtabSize, strtabOffset;
+    uint32_t collation;     // LC_COLLATE when it was sorted
+    uint32_t messages;      // the locale its names are in; see Locale
+    // the layout= file the rules came from, if any; see Layout
+    struct index_dir layout;
+    uint32_t nprefixRules, otherRule, strictLayout;
+    // for an overlay, which shared index it goes on top of
+    uint32_t baseItems;
+    uint64_t baseIno;
+    int64_t baseMtimeSec, baseMtimeNsec;
+};
+
+struct index {
+    const struct index_header* header;
+    const struct index_dir* dirs;
+    const struct record* records;
+    const struct item* items;
+    const struct category* categories;
+    const uint32_t* members;
+    const struct gram* grams;
+    const uint32_t* postings;
+    const uint32_t* shadowed;
+    const struct rule* rules;
+    const uint32_t* ruleTable;
+    const char* strtab;
+    struct index* base;     // the shared index under an overlay; owned
+    // backing storage for a loaded index
+    void* image;
+    size_t size;
+    uint64_t ino;
+    int64_t mtimeSec, mtimeNsec;
+    // backing storage for an index over the model
+    struct index_header ownHeader;
+    struct index_dir* ownDirs;
+};
+
+#define INDEX_ALIGN(x) (((x) + 7u) & ~(size_t)7u)
+#define INDEX_STR(IDX, OFF) ((IDX)->strtab + (OFF))
+
+// for the attach functions: returns 0 unless N Ts at OFF fit in the image
+#define CHECK_TABLE(N, OFF, T) do{\
+    if((OFF) % 8 != 0 || (OFF) > size || (N) > (size - (OFF)) / sizeof(T)) return 0;\
+}while(0)
+
+/**
+ * attachIndex
+ *
+ * Validates an index image and points the table members of idx into it.
+ *
+ * @returns 1 if the image is usable, 0 otherwise
+ */
+static int attachIndex(struct index* idx, void* image, size_t size)
+{
+    const struct index_header* h = (const struct index_header*)image;
+    if(size < sizeof(struct index_header)) return 0;
+    if(memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if(h->version != INDEX_VERSION) return 0;
+    if(h->size != size) return 0;
+    CHECK_TABLE(h->ndirs, h->dirsOffset, struct index_dir);
+    CHECK_TABLE(h->nrecords, h->recordsOffset, struct record);
+    CHECK_TABLE(h->nitems, h->itemsOffset, struct item);
+    CHECK_TABLE(h->ncategories, h->categoriesOffset, struct category);
+    CHECK_TABLE(h->nmembers, h->membersOffset, uint32_t);
+    CHECK_TABLE(h->ngrams, h->gramsOffset, struct gram);
+    CHECK_TABLE(h->npostings, h->postingsOffset, uint32_t);
+    CHECK_TABLE(h->nshadowed, h->shadowedOffset, uint32_t);
+    CHECK_TABLE(h->nrules, h->rulesOffset, struct rule);
+    CHECK_TABLE(h->nruleTable, h->ruleTableOffset, uint32_t);
+    CHECK_TABLE(h->strtabSize, h->strtabOffset, char);
+    // the string table must be terminated so no lookup can run off the end
+    if(h->strtabSize == 0
+            || ((const char*)image)[h->strtabOffset + h->strtabSize - 1] != '\0')
+        return 0;
+    if(h->collation >= h->strtabSize) return 0;
+    if(h->messages >= h->strtabSize) return 0;
+    if(h->layout.path >= h->strtabSize) return 0;
+
+    idx->header = h;
+    idx->dirs = (const struct index_dir*)((char*)image + h->dirsOffset);
+    idx->records = (const struct record*)((char*)image + h->recordsOffset);
+    idx->items = (const struct item*)((char*)image + h->itemsOffset);
+    idx->categories = (const struct category*)((char*)image + h->categoriesOffset);
+    idx->members = (const uint32_t*)((char*)image + h->membersOffset);
+    idx->grams = (const struct gram*)((char*)image + h->gramsOffset);
+    idx->postings = (const uint32_t*)((char*)image + h->postingsOffset);
+    idx->shadowed = (const uint32_t*)((char*)image + h->shadowedOffset);
+    idx->rules = (const struct rule*)((char*)image + h->rulesOffset);
+    idx->ruleTable = (const uint32_t*)((char*)image + h->ruleTableOffset);
+    idx->strtab = (const char*)image + h->strtabOffset;
+    idx->image = image;
+    idx->size = size;
+
+    // reject anything that would point outside of the tables
+    for(uint32_t i = 0; i < h->ndirs; ++i)
+        if(idx->dirs[i].path >= h->strtabSize) return 0;
+    for(uint32_t i = 0; i < h->nrecords; ++i) {
+        const struct record* r = &idx->records[i];
+        if(r->dir >= h->ndirs || r->name >= h->strtabSize
+                || r->Name >= h->strtabSize || r->Exec >= h->strtabSize
+                || r->Categories >= h->strtabSize
+                || r->Icon >= h->strtabSize || r->Path >= h->strtabSize
+                || r->TryExec >= h->strtabSize
+                || r->search >= h->strtabSize || r->id >= h->strtabSize
+                || r->key >= h->strtabSize)
+            return 0;
+    }
+    for(uint32_t i = 0; i < h->nitems; ++i) {
+        const struct item* it = &idx->items[i];
+        if(it->Name >= h->strtabSize || it->Exec >= h->strtabSize
+                || it->Icon >= h->strtabSize || it->Path >= h->strtabSize
+                || it->TryExec >= h->strtabSize
+                || it->search >= h->strtabSize || it->id >= h->strtabSize
+                || it->key >= h->strtabSize)
+            return 0;
+    }
+    for(uint32_t i = 0; i < h->ncategories; ++i) {
+        const struct category* c = &idx->categories[i];
+        if(c->name >= h->strtabSize || c->label >= h->strtabSize
+                || c->parent > h->ncategories
+                || c->first > h->nmembers
+                || c->count > h->nmembers - c->first)
+            return 0;
+        // rendering goes down the submenus, so they can't go round
+        uint32_t parent = c->parent;
+        for(uint32_t n = 0; parent && n < h->ncategories; ++n)
+            parent = idx->categories[parent - 1].parent;
+        if(parent) return 0;
+    }
+    // the same goes for the rules, and ruleTable can never fill up
+    if(h->nprefixRules > h->nrules || h->otherRule > h->nrules
+            || (h->nruleTable & (h->nruleTable - 1))
+            || (h->nrules && 2 * (h->nrules - h->nprefixRules) > h->nruleTable))
+        return 0;
+    for(uint32_t i = 0; i < h->nrules; ++i) {
+        const struct rule* r = &idx->rules[i];
+        if(r->name >= h->strtabSize || r->label >= h->strtabSize
+                || r->target >= h->nrules || r->parent > h->nrules)
+            return 0;
+        uint32_t parent = r->parent;
+        for(uint32_t n = 0; parent && n < h->nrules; ++n)
+            parent = idx->rules[parent - 1].parent;
+        if(parent) return 0;
+    }
+    for(uint32_t i = 0; i < h->nruleTable; ++i)
+        if(idx->ruleTable[i] > h->nrules - h->nprefixRules) return 0;
+    // the shared items come first; see Shared index
+    if(!(h->flags & INDEX_OVERLAY) && (h->baseItems || h->nshadowed)) return 0;
+    for(uint32_t i = 0; i < h->nmembers; ++i)
+        if(idx->members[i] >= (uint64_t)h->baseItems + h->nitems) return 0;
+    for(uint32_t i = 0; i < h->nshadowed; ++i)
+        if(idx->shadowed[i] >= h->baseItems) return 0;
+    // grams and postings are big and only -s needs them, so findGram
+    // checks the ones it uses instead
+
+    return 1;
+}
+
+static void releaseIndex(struct index* idx)
+{
+    if(idx->image)
+        munmap(idx->image, idx->size);
+    if(idx->base) {
+        releaseIndex(idx->base);
+        free(idx->base);
+    }
+    free(idx->ownDirs);
+    memset(idx, 0, sizeof(struct index));
+}
+
+// what the index has to have been built with besides the path= list
+static uint32_t indexFlags()
+{
+    return (useAllCategories ? INDEX_ALLCATEGORIES : 0) | INDEX_RECURSE(recurseDepth);
+}
+
+/**
+ * buildIndex
+ *
+ * Points idx at the (already sorted) model, on top of base if that is
+ * set. Nothing but the header and the directory table is created.
+ */
+static void buildIndex(struct index* idx, struct index* base)
+{
+    size_t ndirs = 0;
+    struct entry* np = NULL;
+    SLIST_FOREACH(np, &dirs, entries) ndirs++;
+
+    memset(idx, 0, sizeof(struct index));
+    idx->ownDirs = calloc(ndirs ? ndirs : 1, sizeof(struct index_dir));
+    size_t i = 0;
+    SLIST_FOREACH(np, &dirs, entries) {
+        idx->ownDirs[i].path = arena_str(&strings, np->path);
+        idx->ownDirs[i].exists = np->exists;
+        idx->ownDirs[i].mtimeSec = np->mtimeSec;
+        idx->ownDirs[i].mtimeNsec = np->mtimeNsec;
+        idx->ownDirs[i].depth = np->depth;
+        ++i;
+    }
+    uint32_t collationName = arena_str(&strings, collation);
+    uint32_t messagesName = arena_str(&strings, messagesLocale());
+    uint32_t layoutName = arena_str(&strings, layoutPath);
+
+    struct index_header* h = &idx->ownHeader;
+    memcpy(h->magic, INDEX_MAGIC, sizeof(h->magic));
+    h->version = INDEX_VERSION;
+    h->flags = indexFlags() | (base ? INDEX_OVERLAY : 0);
+    h->collation = collationName;
+    h->messages = messagesName;
+    if(layoutName) {
+        h->layout.path = layoutName;
+        h->layout.exists = layoutExists;
+        h->layout.mtimeSec = layoutMtimeSec;
+        h->layout.mtimeNsec = layoutMtimeNsec;
+        h->nprefixRules = nprefixRules;
+        h->otherRule = otherRule;
+        h->strictLayout = strictLayout;
+    }
+    size_t off = INDEX_ALIGN(sizeof(struct index_header));
+    h->ndirs = ndirs; h->dirsOffset = off; off = INDEX_ALIGN(off + ndirs * sizeof(struct index_dir));
+    h->nrecords = nrecords; h->recordsOffset = off; off = INDEX_ALIGN(off + nrecords * sizeof(struct record));
+    h->nitems = nitems; h->itemsOffset = off; off = INDEX_ALIGN(off + nitems * sizeof(struct item));
+    h->ncategories = ncategories; h->categoriesOffset = off; off = INDEX_ALIGN(off + ncategories * sizeof(struct category));
+    h->nmembers = nmembers; h->membersOffset = off; off = INDEX_ALIGN(off + nmembers * sizeof(uint32_t));
+    h->ngrams = ngrams; h->gramsOffset = off; off = INDEX_ALIGN(off + ngrams * sizeof(struct gram));
+    h->npostings = npostings; h->postingsOffset = off; off = INDEX_ALIGN(off + npostings * sizeof(uint32_t));
+    h->nshadowed = nshadowed; h->shadowedOffset = off; off = INDEX_ALIGN(off + nshadowed * sizeof(uint32_t));
+    h->nrules = nrules; h->rulesOffset = off; off = INDEX_ALIGN(off + nrules * sizeof(struct rule));
+    h->nruleTable = nruleTable; h->ruleTableOffset = off; off = INDEX_ALIGN(off + nruleTable * sizeof(uint32_t));
+    h->strtabSize = strings.len; h->strtabOffset = off; off += strings.len;
+    h->size = off;
+    if(base) {
+        h->baseItems = base->header->nitems;
+        h->baseIno = base->ino;
+        h->baseMtimeSec = base->mtimeSec;
+        h->baseMtimeNsec = base->mtimeNsec;
+    }
+
+    idx->header = h;
+    idx->dirs = idx->ownDirs;
+    idx->records = records;
+    idx->items = items;
+    idx->categories = categories;
+    idx->members = members;
+    idx->grams = grams;
+    idx->postings = postings;
+    idx->shadowed = shadowed;
+    idx->rules = rules;
+    idx->ruleTable = ruleTable;
+    idx->strtab = strings.base;
+    idx->base = base;
+}
+
+// mmaps the file at path if it is at least minSize big; NULL otherwise
+static void* mapFile(const char* path, size_t minSize, struct stat* st)
+{
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if(fd < 0) return NULL;
+    if(fstat(fd, st) != 0 || st->st_size < (off_t)minSize) {
+        close(fd);
+        return NULL;
+    }
+    void* image = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(image == MAP_FAILED) return NULL;
+    return image;
+}
+
+/**
+ * loadIndex
+ *
+ * mmaps the cache file at path.
+ *
+ * @returns 1 if a structurally valid index was loaded, 0 otherwise
+ */
+static int loadIndex(const char* path, struct index* idx)
+{
+    struct stat st;
+    void* image = mapFile(path, sizeof(struct index_header), &st);
+    if(!image) return 0;
+
+    memset(idx, 0, sizeof(struct index));
+    if(!attachIndex(idx, image, st.st_size)) {
+        munmap(image, st.st_size);
+        memset(idx, 0, sizeof(struct index));
+        return 0;
+    }
+    // what an overlay remembers its shared index by; a rewrite is a
+    // rename, so the inode changes every time
+    idx->ino = st.st_ino;
+    idx->mtimeSec = st.st_mtim.tv_sec;
+    idx->mtimeNsec = st.st_mtim.tv_nsec;
+    return 1;
+}
+
+// dirsAreFresh, or with fresh unset, just whether idx was built from the
+// same path= directories
+static int compareDirs(const struct index* idx, struct entry* np, struct entry* end, int fresh)
+{
+    // the path= directories have to be the same ones in the same order;
+    // the subdirectories found under them are only checked for changes
+    for(uint32_t i = 0; i < idx->header->ndirs; ++i) {
+        const struct index_dir* d = &idx->dirs[i];
+        const char* path = INDEX_STR(idx, d->path);
+        if(!d->depth) {
+            while(np != end && np->depth) np = SLIST_NEXT(np, entries);
+            if(np == end || strcmp(path, np->path) != 0) return 0;
+            np = SLIST_NEXT(np, entries);
+        }
+        if(!fresh) continue;
+
+        struct stat st;
+        int exists = stat(path, &st) == 0;
+        if(exists != (int)d->exists) return 0;
+        if(!exists) continue;
+        if(d->mtimeSec != st.st_mtim.tv_sec || d->mtimeNsec != st.st_mtim.tv_nsec)
+            return 0;
+    }
+    while(np != end && np->depth) np = SLIST_NEXT(np, entries);
+    return np == end;
+}
+
+/**
+ * dirsAreFresh
+ *
+ * Checks that idx was built from the path= directories from np up to
+ * (not including) end, and that none of its directories changed since.
+ * Costs one stat(2) per directory.
+ */
+static int dirsAreFresh(const struct index* idx, struct entry* np, struct entry* end)
+{
+    return compareDirs(idx, np, end, 1);
+}
+
+static struct entry* sharedDirs(const struct index* shared);
+
+static int isCollatedLikeUs(const struct index* idx)
+{
+    return strcmp(INDEX_STR(idx, idx->header->collation), collation) == 0;
+}
+
+// whether idx has the names in our language
+static int isLocalizedLikeUs(const struct index* idx)
+{
+    return strcmp(INDEX_STR(idx, idx->header->messages), messagesLocale()) == 0;
+}
+
+// whether idx was laid out by the layout= file as it is now
+static int layoutIsFresh(const struct index* idx)
+{
+    const struct index_dir* d = &idx->header->layout;
+    if(!layoutPath) return !d->path;
+    if(!d->path || strcmp(INDEX_STR(idx, d->path), layoutPath) != 0) return 0;
+    struct stat st;
+    int exists = stat(layoutPath, &st) == 0;
+    if(exists != (int)d->exists) return 0;
+    return !exists || (d->mtimeSec == st.st_mtim.tv_sec && d->mtimeNsec == st.st_mtim.tv_nsec);
+}
+
+/**
+ * indexIsFresh
+ *
+ * Checks that idx was built with the same options from the same
+ * directories, and that none of them changed since; for an overlay, the
+ * same goes for the shared index under it.
+ */
+static int indexIsFresh(const struct index* idx)
+{
+    if(!isCollatedLikeUs(idx) || !layoutIsFresh(idx)) return 0;
+    if(!idx->base)
+        return idx->header->flags == indexFlags()
+            && dirsAreFresh(idx, SLIST_FIRST(&dirs), NULL);
+
+    struct entry* end = sharedDirs(idx->base);
+    return idx->header->flags == (indexFlags() | INDEX_OVERLAY)
+        && end != NULL
+        && dirsAreFresh(idx->base, end, NULL)
+        && dirsAreFresh(idx, SLIST_FIRST(&dirs), end);
+}
+
+/**
+ * loadLayout
+ *
+ * Gets the rules ready for a rebuild: copied out of old, if that was
+ * laid out by the layout= file as it is now, or compiled anew.
+ */
+static void loadLayout(const struct index* old)
+{
+    if(!layoutPath) return;
+    if(!old || !layoutIsFresh(old)) {
+        compileLayout();
+        return;
+    }
+    const struct index_header* h = old->header;
+    nrules = crules = h->nrules;
+    rules = malloc((nrules ? nrules : 1) * sizeof(struct rule));
+    for(uint32_t i = 0; i < nrules; ++i) {
+        rules[i] = old->rules[i];
+        rules[i].name = arena_str(&strings, INDEX_STR(old, old->rules[i].name));
+        rules[i].label = arena_str(&strings, INDEX_STR(old, old->rules[i].label));
+    }
+    nruleTable = h->nruleTable;
+    ruleTable = malloc((nruleTable ? nruleTable : 1) * sizeof(uint32_t));
+    memcpy(ruleTable, old->ruleTable, nruleTable * sizeof(uint32_t));
+    COUNT(allocations, 2);
+    nprefixRules = h->nprefixRules;
+    otherRule = h->otherRule;
+    strictLayout = h->strictLayout;
+    layoutExists = h->layout.exists;
+    layoutMtimeSec = h->layout.mtimeSec;
+    layoutMtimeNsec = h->layout.mtimeNsec;
+}
+
+// mkdir -p the parent directory of path
+static void makeParents(const char* path, mode_t mode)
+{
+    char* copy = strdup(path);
+    for(char* p = copy + 1; *p; ++p) {
+        if(*p != '/') continue;
+        *p = '\0';
+        mkdir(copy, mode);
+        *p = '/';
+    }
+    free(copy);
+}
+
+/**
+ * writevAll
+ *
+ * Writes the niov buffers of iov to fd, however many writev(2) calls
+ * that takes. Clobbers iov.
+ *
+ * @returns 1 on success, 0 on error (see errno)
+ */
+static int writevAll(int fd, struct iovec* iov, int niov)
+{
+    while(niov > 0) {
+        ssize_t n = writev(fd, iov, niov < IOV_MAX ? niov : IOV_MAX);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        // skip over what was written
+        while(niov > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --niov;
+        }
+        if(niov > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+/**
+ * writeFile
+ *
+ * Saves the niov buffers of iov to path with a single writev(2) into a
+ * file of our own next to path, which is then renamed over it, so
+ * concurrent readers see either the old or the new file, and concurrent
+ * writers don't write into each other's. Clobbers iov.
+ */
+static void writeFile(const char* path, struct iovec* iov, int niov)
+{
+    static const char suffix[] = ".XXXXXX";
+    char* tmpPath = malloc(strlen(path) + sizeof(suffix));
+    strcpy(tmpPath, path);
+    strcat(tmpPath, suffix);
+
+    makeParents(path, 0700);
+    int fd = mkstemp(tmpPath);
+    if(fd < 0) {
+        warn("Failed to write %s", tmpPath);
+        free(tmpPath);
+        return;
+    }
+    // mkstemp makes it 0600, whatever the umask; the shared index is
+    // there for everyone to read
+    mode_t mask = umask(0);
+    umask(mask);
+    int ok = fchmod(fd, 0644 & ~mask) == 0 && writevAll(fd, iov, niov);
+    if(close(fd) != 0 || !ok) {
+        warn("Failed to write %s", tmpPath);
+        unlink(tmpPath);
+    } else if(rename(tmpPath, path) != 0) {
+        warn("Failed to rename %s", tmpPath);
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+}
+
+/**
+ * writeIndex
+ *
+ * Saves idx to path; the tables are gathered straight from the model.
+ */
+static void writeIndex(const char* path, const struct index* idx)
+{
+    static const char padding[8] = { 0 };
+    const struct index_header* h = idx->header;
+
+    // the header is always first, and needs no padding
+    struct iovec iov[2 * 12];
+    iov[0].iov_base = (void*)h;
+    iov[0].iov_len = sizeof(struct index_header);
+    int niov = 1;
+    size_t off = sizeof(struct index_header);
+#define ADD_TABLE(OFF, PTR, SIZE) do{\
+    if((OFF) > off) {\
+        iov[niov].iov_base = (void*)padding;\
+        iov[niov++].iov_len = (OFF) - off;\
+    }\
+    iov[niov].iov_base = (void*)(PTR);\
+    iov[niov++].iov_len = (SIZE);\
+    off = (OFF) + (SIZE);\
+}while(0)
+    ADD_TABLE(h->dirsOffset, idx->dirs, h->ndirs * sizeof(struct index_dir));
+    ADD_TABLE(h->recordsOffset, idx->records, h->nrecords * sizeof(struct record));
+    ADD_TABLE(h->itemsOffset, idx->items, h->nitems * sizeof(struct item));
+    ADD_TABLE(h->categoriesOffset, idx->categories, h->ncategories * sizeof(struct category));
+    ADD_TABLE(h->membersOffset, idx->members, h->nmembers * sizeof(uint32_t));
+    ADD_TABLE(h->gramsOffset, idx->grams, h->ngrams * sizeof(struct gram));
+    ADD_TABLE(h->postingsOffset, idx->postings, h->npostings * sizeof(uint32_t));
+    ADD_TABLE(h->shadowedOffset, idx->shadowed, h->nshadowed * sizeof(uint32_t));
+    ADD_TABLE(h->rulesOffset, idx->rules, h->nrules * sizeof(struct rule));
+    ADD_TABLE(h->ruleTableOffset, idx->ruleTable, h->nruleTable * sizeof(uint32_t));
+    ADD_TABLE(h->strtabOffset, idx->strtab, h->strtabSize);
+#undef ADD_TABLE
+    assert(off == h->size);
+
+    writeFile(path, iov, niov);
+}
+
+/*
+ * Record store
+ *
+ * The records from the previous run are looked up by directory and file
+ * name. When a file still has the inode, size and mtime it was recorded
+ * with, its record is carried over as it is and the file isn't opened, so
+ * a rebuild only parses the files which changed. Deleted files are simply
+ * not found again, and their records are dropped with the old index.
+ */
+struct recordStore {
+    const struct index* idx;
+    uint32_t* dirMap;   // old dir position -> current position, or UINT32_MAX
+    uint32_t* slots;    // record index + 1; 0 if the slot is free
+    size_t mask;
+};
+
+static inline uint32_t hashRecord(uint32_t dir, const char* name)
+{
+    return hashString(name) ^ (dir * 2654435761u);
+}
+
+static void openRecordStore(struct recordStore* rs, const struct index* idx)
+{
+    memset(rs, 0, sizeof(struct recordStore));
+    if(!idx) return;
+    const struct index_header* h = idx->header;
+    rs->idx = idx;
+
+    // the path= list may have changed since
+    rs->dirMap = malloc((h->ndirs ? h->ndirs : 1) * sizeof(uint32_t));
+    for(uint32_t i = 0; i < h->ndirs; ++i) {
+        uint32_t j = 0;
+        struct entry* np = NULL;
+        rs->dirMap[i] = UINT32_MAX;
+        SLIST_FOREACH(np, &dirs, entries) {
+            if(strcmp(np->path, INDEX_STR(idx, idx->dirs[i].path)) == 0) {
+                rs->dirMap[i] = j;
+                break;
+            }
+            ++j;
+        }
+    }
+
+    size_t nslots = 64;
+    while(nslots < 2 * (size_t)h->nrecords) nslots *= 2;
+    rs->slots = calloc(nslots, sizeof(uint32_t));
+    rs->mask = nslots - 1;
+    for(uint32_t i = 0; i < h->nrecords; ++i) {
+        const struct record* r = &idx->records[i];
+        uint32_t dir = rs->dirMap[r->dir];
+        if(dir == UINT32_MAX) continue;
+        size_t k = hashRecord(dir, INDEX_STR(idx, r->name)) & rs->mask;
+        while(rs->slots[k]) k = (k + 1) & rs->mask;
+        rs->slots[k] = i + 1;
+    }
+}
+
+static void closeRecordStore(struct recordStore* rs)
+{
+    free(rs->dirMap);
+    free(rs->slots);
+    memset(rs, 0, sizeof(struct recordStore));
+}
+
+// @returns what the previous run recorded for name in dirs[dir], or NULL
+static const struct record* findRecord(const struct recordStore* rs, uint32_t dir, const char* name)
+{
+    if(!rs->slots) return NULL;
+    for(size_t k = hashRecord(dir, name) & rs->mask; rs->slots[k]; k = (k + 1) & rs->mask) {
+        const struct record* r = &rs->idx->records[rs->slots[k] - 1];
+        if(rs->dirMap[r->dir] == dir && strcmp(INDEX_STR(rs->idx, r->name), name) == 0)
+            return r;
+    }
+    return NULL;
+}
+
+// carries what prev, a record of the previous index, says over into r;
+// its collation key too, unless idx was made under another locale
+static void reuseRecord(struct record* r, const struct record* prev, const struct index* idx, int sameCollation)
+{
+    r->isOk = prev->isOk;
+    if(!prev->isOk) return;
+    r->Name = arena_str(&strings, INDEX_STR(idx, prev->Name));
+    r->Exec = arena_str(&strings, INDEX_STR(idx, prev->Exec));
+    r->Categories = prev->Categories
+        ? arena_add(&strings, INDEX_STR(idx, prev->Categories), strlen(INDEX_STR(idx, prev->Categories)))
+        : 0;
+    r->Icon = arena_str(&strings, INDEX_STR(idx, prev->Icon));
+    r->Path = arena_str(&strings, INDEX_STR(idx, prev->Path));
+    r->TryExec = arena_str(&strings, INDEX_STR(idx, prev->TryExec));
+    r->search = arena_str(&strings, INDEX_STR(idx, prev->search));
+    r->key = sameCollation
+        ? arena_str(&strings, INDEX_STR(idx, prev->key))
+        : collationKey(&strings, INDEX_STR(idx, prev->Name));
+    r->useTerminal = prev->useTerminal;
+}
+
+/*
+ * Desktop file IDs
+ *
+ * The same application often has a .desktop file in more than one of the
+ * path= directories, and like XDG we only look at the one in the
+ * directory with the highest precedence. A path listed later takes
+ * precedence over the ones before it; addPath inserts at the head, so
+ * dirs is walked in exactly that order and the first file found with an
+ * ID wins. Files with an ID already taken are neither stat()ed nor
+ * opened, which also lets e.g. a Hidden=true copy in
+ * ~/.local/share/applications hide the system one. A file in a
+ * subdirectory goes by its entry's prefix plus its name.
+ */
+struct idSet {
+    uint32_t* slots;    // offset of the ID in strings; 0 if the slot is free
+    size_t size, count; // size is always a power of 2
+};
+
+static uint32_t* findId(struct idSet* set, const char* id)
+{
+    size_t mask = set->size - 1;
+    for(size_t i = hashString(id) & mask;; i = (i + 1) & mask) {
+        uint32_t* slot = &set->slots[i];
+        if(!*slot || strcmp(STR(*slot), id) == 0)
+            return slot;
+    }
+}
+
+// @returns 1 if no file with this ID was found yet
+static int idIsFree(struct idSet* set, const char* id)
+{
+    return !set->count || !*findId(set, id);
+}
+
+// files id, an offset in strings
+static void takeId(struct idSet* set, uint32_t id)
+{
+    // keep the load factor under 1/2
+    if(2 * (set->count + 1) > set->size) {
+        uint32_t* old = set->slots;
+        size_t nold = set->size;
+        set->size = nold ? nold * 2 : 256;
+        set->slots = calloc(set->size, sizeof(uint32_t));
+        for(size_t i = 0; i < nold; ++i)
+            if(old[i]) *findId(set, STR(old[i])) = old[i];
+        free(old);
+    }
+    *findId(set, STR(id)) = id;
+    set->count++;
+}
+
+/*
+ * Shared index
+ *
+ * On a machine with many users, everyone has the same system path=
+ * directories under their own. jakobmenu --shared-index, run as root
+ * (e.g. from a package manager hook), indexes the path= directories of
+ * the system config, up to the first one in a home directory, into an
+ * ordinary index at sharedCache=.
+ *
+ * When a user's lowest-precedence path= directories are exactly the
+ * ones in there, and the shared index is fresh and was built with the
+ * same options, their own cache is only an overlay: the records and
+ * items of their own directories, and the categories and members of
+ * the whole menu, where item numbers below the shared index's item count
+ * mean its items. So only their own directories are ever parsed, and
+ * the shared items and strings are read straight out of the shared
+ * file, whose pages are the same for everyone. A shared item is hidden
+ * by a file of the user's with the same desktop file ID, as it would be
+ * without a shared index; search skips the ones listed in shadowed.
+ */
+
+/**
+ * sharedDirs
+ *
+ * Finds where in dirs the directories shared covers should be: it has to
+ * have been built with our options and layout, from our lowest-precedence path=
+ * directories. Whether they are the same ones, and unchanged, is up to
+ * dirsAreFresh.
+ *
+ * @returns the first of those in dirs, or NULL if shared is no good
+ */
+static struct entry* sharedDirs(const struct index* shared)
+{
+    if(shared->header->flags != indexFlags() || !layoutIsFresh(shared)) return NULL;
+    uint32_t nshared = 0, nroots = 0;
+    for(uint32_t i = 0; i < shared->header->ndirs; ++i)
+        if(!shared->dirs[i].depth) nshared++;
+    struct entry* np = NULL;
+    SLIST_FOREACH(np, &dirs, entries)
+        if(!np->depth) nroots++;
+    if(!nshared || nshared > nroots) return NULL;
+
+    // ours take precedence, so they come first
+    uint32_t skip = nroots - nshared;
+    for(np = SLIST_FIRST(&dirs);; np = SLIST_NEXT(np, entries)) {
+        if(np->depth) continue;
+        if(!skip) break;
+        --skip;
+    }
+    return np;
+}
+
+// @returns the shared index, if there is one that fits, and where its
+//          directories start in dirs
+static struct index* loadShared(struct entry** head)
+{
+    if(!useCache || !sharedCachePath) return NULL;
+    struct index* shared = malloc(sizeof(struct index));
+    memset(shared, 0, sizeof(struct index));
+    char* path = localizedPath(sharedCachePath);
+    if(!loadIndex(path, shared) || !isLocalizedLikeUs(shared)
+            || !(*head = sharedDirs(shared))) {
+        releaseIndex(shared);
+        free(shared);
+        shared = NULL;
+    }
+    free(path);
+    return shared;
+}
+
+// @returns 1 if overlay was built on top of shared
+static int isOverlayOf(const struct index* overlay, const struct index* shared)
+{
+    const struct index_header* h = overlay->header;
+    return (h->flags & INDEX_OVERLAY)
+        && h->baseItems == shared->header->nitems
+        && h->baseIno == shared->ino
+        && h->baseMtimeSec == shared->mtimeSec
+        && h->baseMtimeNsec == shared->mtimeNsec;
+}
+
+/**
+ * mergeShared
+ *
+ * Files the items of shared under their categories, except for the ones
+ * whose desktop file ID is in ids.
+ */
+static void mergeShared(const struct index* shared, struct idSet* ids)
+{
+    const struct index_header* h = shared->header;
+    uint32_t cshadowed = 0;
+    char* hidden = calloc(h->nitems ? h->nitems : 1, 1);
+    for(uint32_t i = 0; i < h->nitems; ++i) {
+        if(idIsFree(ids, INDEX_STR(shared, shared->items[i].id))) continue;
+        hidden[i] = 1;
+        APPEND(shadowed, nshadowed, cshadowed, i);
+    }
+    for(uint32_t i = 0; i < h->ncategories; ++i) {
+        const struct category* c = &shared->categories[i];
+        uint32_t category = UINT32_MAX;
+        for(uint32_t j = 0; j < c->count; ++j) {
+            uint32_t item = shared->members[c->first + j];
+            if(hidden[item]) continue;
+            // so a category with nothing left in it isn't created
+            if(category == UINT32_MAX)
+                category = namedCategory(INDEX_STR(shared, c->name));
+            ADD_MEMBER(category, item);
+        }
+    }
+    COUNT(shared, h->nitems - nshadowed);
+    free(hidden);
+}
+
+/**
+ * parseAll
+ *
+ * Records every .desktop file in the path= directories, parses the ones
+ * old (the previous index, if any) knows nothing about, and builds the
+ * menu from the records, and from shared, if there is one.
+ */
+static void parseAll(const struct index* old, const struct index* shared)
+{
+    struct recordStore store;
+    struct idSet ids;
+    struct entry *np = NULL;
+    int* dirFds = NULL;
+    uint32_t* slots = NULL;
+    size_t ndirs = 0, nslots = 0, cslots = 0;
+    uint32_t dirIndex = 0;
+    char* id = NULL;
+    size_t idCap = 0;
+    time_t scanStart = time(NULL);
+    int sameCollation = old && isCollatedLikeUs(old);
+    struct timing t;
+    phaseBegin(&t);
+
+    if(shared) {
+        baseItems = shared->items;
+        baseStrtab = shared->strtab;
+        nbaseItems = shared->header->nitems;
+        recollateBase = !isCollatedLikeUs(shared);
+    }
+    walkDirs(scanStart);
+    SLIST_FOREACH(np, &dirs, entries) ndirs++;
+    dirFds = malloc((ndirs ? ndirs : 1) * sizeof(int));
+
+    memset(&ids, 0, sizeof(ids));
+    openRecordStore(&store, old);
+    for(np = SLIST_FIRST(&dirs); np != NULL; np = SLIST_NEXT(np, entries), ++dirIndex) {
+        struct stat st;
+        size_t prefixLen = strlen(np->prefix);
+        dirFds[dirIndex] = np->fd;
+        if(np->fd < 0) continue;
+        for(const char* name = np->names; name < np->names + np->namesLen; name += strlen(name) + 1) {
+            size_t namelen = strlen(name);
+            // files in subdirectories go by prefix-name
+            const char* fileId = name;
+            if(prefixLen) {
+                if(prefixLen + namelen + 1 > idCap) {
+                    idCap = prefixLen + namelen + 1;
+                    id = realloc(id, idCap);
+                }
+                memcpy(id, np->prefix, prefixLen);
+                memcpy(id + prefixLen, name, namelen + 1);
+                fileId = id;
+            }
+            if(!idIsFree(&ids, fileId)) {
+                COUNT(shadowed, 1);
+                continue;
+            }
+            // a file we can't stat wouldn't open either
+            if(fstatat(np->fd, name, &st, 0) != 0) continue;
+            COUNT(files, 1);
+
+            struct record r;
+            memset(&r, 0, sizeof(r));
+            r.dir = dirIndex;
+            r.name = arena_add(&strings, name, namelen);
+            r.ino = st.st_ino;
+            r.size = st.st_size;
+            r.mtimeSec = st.st_mtim.tv_sec;
+            r.mtimeNsec = st.st_mtim.tv_nsec;
+            // see walkDir; -1 never matches, so it gets parsed next time
+            if(st.st_mtim.tv_sec >= scanStart) r.mtimeSec = -1;
+
+            const struct record* prev = findRecord(&store, dirIndex, name);
+            if(prev && prev->ino == r.ino && prev->size == r.size
+                    && prev->mtimeSec == st.st_mtim.tv_sec
+                    && prev->mtimeNsec == st.st_mtim.tv_nsec)
+            {
+                reuseRecord(&r, prev, old, sameCollation);
+                COUNT(reused, 1);
+            } else {
+                APPEND(slots, nslots, cslots, nrecords);
+                COUNT(parsed, 1);
+            }
+            r.id = prefixLen ? arena_str(&strings, fileId) : r.name;
+            APPEND(records, nrecords, crecords, r);
+            takeId(&ids, r.id);
+        }
+        free(np->names);
+        np->names = NULL;
+        np->namesLen = np->namesCap = 0;
+    }
+    closeRecordStore(&store);
+    free(id);
+    phaseEnd(PHASE_ENUMERATE, &t);
+
+    phaseBegin(&t);
+    parseFiles(dirFds, slots, nslots);
+    for(uint32_t i = 0; i < nrecords; ++i)
+        addRecord(&records[i]);
+    if(shared) mergeShared(shared, &ids);
+    free(ids.slots);
+    phaseEnd(PHASE_PARSE, &t);
+
+    SLIST_FOREACH(np, &dirs, entries) {
+        if(np->fd >= 0) close(np->fd);
+        np->fd = -1;
+    }
+    free(dirFds);
+    free(slots);
+}
+
+/*
+ * Icons
+ *
+ * With iconTheme= (or -i) set, items get an icon="..." attribute. Looking
+ * an icon up by the book means going through the size directories of the
+ * theme, of every theme it inherits from and of hicolor, so that is only
+ * done when building the icon index: the best file for every icon name,
+ * in a hash table saved next to the menu cache. It is mmapped like the
+ * menu index, and rendering costs one lookup per item. Like GTK's
+ * icon-theme.cache, the index remembers the mtime of every directory it
+ * looked at and is rebuilt when any of them changes.
+ */
+#define ICONS_MAGIC "jakobico"
+#define ICONS_VERSION 2
+#define ICONS_SUFFIX ".icons"
+
+struct icons_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint32_t key;       // what the index was built for; see iconKey
+    uint32_t ndirs, dirsOffset;
+    uint32_t nbuckets, bucketsOffset;
+    uint32_t nicons, iconsOffset;
+    uint32_t strtabSize, strtabOffset;
+};
+
+// buckets[hash % nbuckets] and next are an icon's index + 1; 0 ends a chain
+struct icon {
+    uint32_t hash;
+    uint32_t name, path;
+    uint32_t next;
+};
+
+struct icons {
+    const struct icons_header* header;
+    const struct index_dir* dirs;
+    const uint32_t* buckets;
+    const struct icon* icons;
+    const char* strtab;
+    void* image;
+    size_t size;
+    int mapped;     // image is mmapped rather than malloc'd
+};
+
+static struct icons icons;
+
+static int attachIcons(struct icons* ic, void* image, size_t size)
+{
+    const struct icons_header* h = (const struct icons_header*)image;
+    if(size < sizeof(struct icons_header)) return 0;
+    if(memcmp(h->magic, ICONS_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if(h->version != ICONS_VERSION) return 0;
+    if(h->size != size) return 0;
+    CHECK_TABLE(h->ndirs, h->dirsOffset, struct index_dir);
+    CHECK_TABLE(h->nbuckets, h->bucketsOffset, uint32_t);
+    CHECK_TABLE(h->nicons, h->iconsOffset, struct icon);
+    CHECK_TABLE(h->strtabSize, h->strtabOffset, char);
+    if(h->strtabSize == 0
+            || ((const char*)image)[h->strtabOffset + h->strtabSize - 1] != '\0'
+            || h->key >= h->strtabSize)
+        return 0;
+
+    ic->header = h;
+    ic->dirs = (const struct index_dir*)((char*)image + h->dirsOffset);
+    ic->buckets = (const uint32_t*)((char*)image + h->bucketsOffset);
+    ic->icons = (const struct icon*)((char*)image + h->iconsOffset);
+    ic->strtab = (const char*)image + h->strtabOffset;
+    ic->image = image;
+    ic->size = size;
+
+    for(uint32_t i = 0; i < h->ndirs; ++i)
+        if(ic->dirs[i].path >= h->strtabSize) return 0;
+    for(uint32_t i = 0; i < h->nbuckets; ++i)
+        if(ic->buckets[i] > h->nicons) return 0;
+    for(uint32_t i = 0; i < h->nicons; ++i) {
+        const struct icon* icon = &ic->icons[i];
+        // chains only ever point back, so walking one always ends
+        if(icon->name >= h->strtabSize || icon->path >= h->strtabSize || icon->next > i)
+            return 0;
+    }
+    return 1;
+}
+
+static void releaseIcons(struct icons* ic)
+{
+    if(ic->image) {
+        if(ic->mapped) munmap(ic->image, ic->size);
+        else free(ic->image);
+    }
+    memset(ic, 0, sizeof(struct icons));
+}
+
+/**
+ * findIcon
+ *
+ * Looks up Icon= value name, which may also be an absolute path or a file
+ * name with an extension.
+ *
+ * @returns the path to the icon, or NULL if there is none
+ */
+static const char* findIcon(const struct icons* ic, const char* name)
+{
+    if(*name == '/') return name;
+    if(!ic->header || !ic->header->nbuckets || !*name) return NULL;
+
+    size_t len = strlen(name);
+    if(len > 4 && (strcmp(name + len - 4, ".png") == 0
+                || strcmp(name + len - 4, ".svg") == 0
+                || strcmp(name + len - 4, ".xpm") == 0))
+        len -= 4;
+    uint32_t hash = hashBytes(name, len);
+    uint32_t i = ic->buckets[hash % ic->header->nbuckets];
+    while(i) {
+        const struct icon* icon = &ic->icons[i - 1];
+        const char* iconName = INDEX_STR(ic, icon->name);
+        if(icon->hash == hash && strncmp(iconName, name, len) == 0 && iconName[len] == '\0')
+            return INDEX_STR(ic, icon->path);
+        i = icon->next;
+    }
+    return NULL;
+}
+
+// where themes are looked for, most important first
+static char** iconBaseDirs(size_t* n)
+{
+    char** bases = NULL;
+    size_t nbases = 0, cbases = 0;
+    APPEND(bases, nbases, cbases, expand("~/.local/share/icons"));
+    APPEND(bases, nbases, cbases, expand("~/.icons"));
+
+    const char* dataDirs = getenv("XDG_DATA_DIRS");
+    if(!dataDirs || !*dataDirs) dataDirs = "/usr/local/share:/usr/share";
+    while(*dataDirs) {
+        size_t len = strcspn(dataDirs, ":");
+        if(len) {
+            char* base = malloc(len + sizeof("/icons"));
+            memcpy(base, dataDirs, len);
+            strcpy(base + len, "/icons");
+            APPEND(bases, nbases, cbases, base);
+        }
+        dataDirs += len;
+        if(*dataDirs) ++dataDirs;
+    }
+    *n = nbases;
+    return bases;
+}
+
+// everything the index depends on besides directory contents
+static char* iconKey(char** bases, size_t nbases)
+{
+    size_t len = strlen(iconTheme) + 32;
+    for(size_t i = 0; i < nbases; ++i) len += strlen(bases[i]) + 1;
+    char* key = malloc(len);
+    char* p = key + sprintf(key, "%s\n%ld\n", iconTheme, iconSize);
+    for(size_t i = 0; i < nbases; ++i) p += sprintf(p, "%s:", bases[i]);
+    return key;
+}
+
+static int iconsAreFresh(const struct icons* ic, const char* key)
+{
+    if(strcmp(INDEX_STR(ic, ic->header->key), key) != 0) return 0;
+    for(uint32_t i = 0; i < ic->header->ndirs; ++i) {
+        const struct index_dir* d = &ic->dirs[i];
+        struct stat st;
+        int exists = stat(INDEX_STR(ic, d->path), &st) == 0;
+        if(exists != (int)d->exists) return 0;
+        if(!exists) continue;
+        if(d->mtimeSec != st.st_mtim.tv_sec || d->mtimeNsec != st.st_mtim.tv_nsec)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * What building the icon index needs to know about a theme, from its
+ * index.theme.
+ */
+struct themeDir {
+    char* name;
+    int size, minSize, maxSize, threshold;
+    char type;          // 'F'ixed, 'S'calable or 'T'hreshold
+    int listed;         // named in Directories=
+};
+
+struct theme {
+    char* name;
+    char* inherits;     // as written, comma separated
+    struct themeDir* dirs;
+    size_t ndirs, cdirs;
+};
+
+struct iconBuild {
+    struct arena strings;
+    struct index_dir* dirs;
+    uint32_t ndirs, cdirs;
+    struct icon* icons;
+    uint32_t nicons, cicons;
+    uint64_t* scores;   // parallel to icons; lower is better
+    uint32_t* table;    // icon index + 1, open addressing
+    size_t ntable;      // always a power of 2
+    time_t scanStart;
+};
+
+// reads base/name/index.theme out of the first base that has one
+static void readTheme(struct theme* t, char** bases, size_t nbases)
+{
+    struct dfile f;
+    char* path = NULL;
+    for(size_t i = 0; i < nbases; ++i) {
+        path = realloc(path, strlen(bases[i]) + strlen(t->name) + sizeof("//index.theme"));
+        sprintf(path, "%s/%s/index.theme", bases[i], t->name);
+        memset(&f, 0, sizeof(f));
+        f.dirfd = AT_FDCWD;
+        f.name = path;
+        f.fd = -1;
+        if(readRest(&f)) break;
+    }
+    free(path);
+    if(!f.complete) return;
+
+    char* listed = NULL;
+    struct themeDir* dir = NULL;
+    int inThemeSection = 0;
+    char* end = f.buf + f.len;
+    for(char* line = f.buf, *next; line < end; line = next) {
+        char* eol = memchr(line, '\n', end - line);
+        if(!eol) eol = end;
+        next = eol + 1;
+        *eol = '\0';
+        while(line < eol && isspace(*line)) ++line;
+        if(*line == '#') continue;
+        if(*line == '[') {
+            char* close = strchr(line, ']');
+            if(!close) continue;
+            *close = '\0';
+            inThemeSection = strcmp(line + 1, "Icon Theme") == 0;
+            dir = NULL;
+            if(!inThemeSection) {
+                struct themeDir d;
+                memset(&d, 0, sizeof(d));
+                d.name = strdup(line + 1);
+                d.type = 'T';
+                d.threshold = 2;
+                d.minSize = d.maxSize = -1;
+                APPEND(t->dirs, t->ndirs, t->cdirs, d);
+                dir = &t->dirs[t->ndirs - 1];
+            }
+            continue;
+        }
+        char *key, *value;
+        size_t keyLen;
+        if(!splitLine(line, eol, &key, &keyLen, &value)) continue;
+        if(inThemeSection) {
+            if(strcmp(key, "Inherits") == 0) {
+                free(t->inherits);
+                t->inherits = strdup(value);
+            } else if(strcmp(key, "Directories") == 0) {
+                free(listed);
+                listed = strdup(value);
+            }
+        } else if(dir) {
+            if(strcmp(key, "Size") == 0) dir->size = atoi(value);
+            else if(strcmp(key, "MinSize") == 0) dir->minSize = atoi(value);
+            else if(strcmp(key, "MaxSize") == 0) dir->maxSize = atoi(value);
+            else if(strcmp(key, "Threshold") == 0) dir->threshold = atoi(value);
+            else if(strcmp(key, "Type") == 0) dir->type = value[0];
+            // we don't do HiDPI; dropping the size makes it unlisted below
+            else if(strcmp(key, "Scale") == 0 && atoi(value) > 1) dir->size = 0;
+        }
+    }
+    free(f.buf);
+
+    // only the directories in Directories= count
+    for(char* name = listed ? strtok(listed, ",") : NULL; name; name = strtok(NULL, ",")) {
+        while(isspace(*name)) ++name;
+        for(size_t i = 0; i < t->ndirs; ++i)
+            if(strcmp(t->dirs[i].name, name) == 0 && t->dirs[i].size > 0)
+                t->dirs[i].listed = 1;
+    }
+    free(listed);
+    for(size_t i = 0; i < t->ndirs; ++i) {
+        if(t->dirs[i].minSize < 0) t->dirs[i].minSize = t->dirs[i].size;
+        if(t->dirs[i].maxSize < 0) t->dirs[i].maxSize = t->dirs[i].size;
+    }
+}
+
+// how far the icons in d are from iconSize, as in the icon theme spec
+static int themeDirDistance(const struct themeDir* d)
+{
+    int size = (int)iconSize;
+    switch(d->type) {
+        case 'F':
+            return abs(d->size - size);
+        case 'S':
+            if(size < d->minSize) return d->minSize - size;
+            if(size > d->maxSize) return size - d->maxSize;
+            return 0;
+        default:
+            if(size < d->size - d->threshold) return d->size - d->threshold - size;
+            if(size > d->size + d->threshold) return size - d->size - d->threshold;
+            return 0;
+    }
+}
+
+// remembers path as it is now, so the index goes stale when it changes
+static int addIconDir(struct iconBuild* b, const char* path, struct stat* st)
+{
+    struct index_dir d;
+    memset(&d, 0, sizeof(d));
+    d.path = arena_str(&b->strings, path);
+    if(stat(path, st) == 0) {
+        d.exists = 1;
+        d.mtimeSec = st->st_mtim.tv_sec;
+        d.mtimeNsec = st->st_mtim.tv_nsec;
+        // see parseAll
+        if(st->st_mtim.tv_sec >= b->scanStart) d.mtimeSec = -1;
+    }
+    APPEND(b->dirs, b->ndirs, b->cdirs, d);
+    return d.exists;
+}
+
+static uint32_t* findIconSlot(struct iconBuild* b, const char* name, size_t len, uint32_t hash)
+{
+    size_t mask = b->ntable - 1;
+    for(size_t i = hash & mask;; i = (i + 1) & mask) {
+        uint32_t* slot = &b->table[i];
+        if(!*slot) return slot;
+        const struct icon* icon = &b->icons[*slot - 1];
+        const char* iconName = b->strings.base + icon->name;
+        if(icon->hash == hash && strncmp(iconName, name, len) == 0 && iconName[len] == '\0')
+            return slot;
+    }
+}
+
+// offers dir/file (whose name is len long without its extension) as name
+static void offerIcon(struct iconBuild* b, const char* dir, const char* file, size_t len, uint64_t score)
+{
+    uint32_t hash = hashBytes(file, len);
+    uint32_t* slot = findIconSlot(b, file, len, hash);
+    if(*slot && b->scores[*slot - 1] <= score) return;
+
+    char* path = malloc(strlen(dir) + strlen(file) + 2);
+    sprintf(path, "%s/%s", dir, file);
+    if(*slot) {
+        b->icons[*slot - 1].path = arena_str(&b->strings, path);
+        b->scores[*slot - 1] = score;
+        free(path);
+        return;
+    }
+    struct icon icon;
+    memset(&icon, 0, sizeof(icon));
+    icon.hash = hash;
+    icon.name = arena_add(&b->strings, file, len);
+    icon.path = arena_str(&b->strings, path);
+    free(path);
+    if(b->nicons >= b->cicons)
+        b->scores = realloc(b->scores, (b->cicons ? b->cicons * 2 : 64) * sizeof(uint64_t));
+    APPEND(b->icons, b->nicons, b->cicons, icon);
+    b->scores[b->nicons - 1] = score;
+    *findIconSlot(b, file, len, hash) = b->nicons;
+
+    // keep the load factor under 1/2
+    if(2 * b->nicons > b->ntable) {
+        free(b->table);
+        b->ntable *= 2;
+        b->table = calloc(b->ntable, sizeof(uint32_t));
+        for(uint32_t i = 0; i < b->nicons; ++i) {
+            const struct icon* it = &b->icons[i];
+            const char* itName = b->strings.base + it->name;
+            *findIconSlot(b, itName, strlen(itName), it->hash) = i + 1;
+        }
+    }
+}
+
+// offers every icon in dir, ranked by rank, then distance, then format
+static void scanIconDir(struct iconBuild* b, const char* dir, uint32_t rank, int distance)
+{
+    struct stat st;
+    if(!addIconDir(b, dir, &st)) return;
+    int fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(fd < 0) return;
+    struct dirScan scan;
+    if(dirScanOpen(&scan, fd)) {
+        const char* name;
+        size_t len;
+        unsigned char type;
+        while((name = dirScanNext(&scan, &len, &type)) != NULL) {
+            int format;
+            if(len <= 4 || !mayBeFile(type)) continue;
+            if(strcmp(name + len - 4, ".png") == 0) format = 0;
+            else if(strcmp(name + len - 4, ".svg") == 0) format = 1;
+            else if(strcmp(name + len - 4, ".xpm") == 0) format = 2;
+            else continue;
+            offerIcon(b, dir, name, len - 4,
+                    ((uint64_t)rank << 40) | ((uint64_t)distance << 8) | format);
+        }
+        dirScanClose(&scan);
+    }
+    close(fd);
+}
+
+// appends name, then whatever it inherits from, depth first
+static void addTheme(struct theme** themes, size_t* nthemes, size_t* cthemes,
+        const char* name, char** bases, size_t nbases)
+{
+    for(size_t i = 0; i < *nthemes; ++i)
+        if(strcmp((*themes)[i].name, name) == 0) return;
+    struct theme t;
+    memset(&t, 0, sizeof(t));
+    t.name = strdup(name);
+    readTheme(&t, bases, nbases);
+    APPEND(*themes, *nthemes, *cthemes, t);
+    if(!t.inherits) return;
+    char* inherits = strdup(t.inherits);
+    char* save = NULL;
+    for(char* parent = strtok_r(inherits, ",", &save); parent; parent = strtok_r(NULL, ",", &save)) {
+        while(isspace(*parent)) ++parent;
+        if(*parent) addTheme(themes, nthemes, cthemes, parent, bases, nbases);
+    }
+    free(inherits);
+}
+
+/**
+ * scanIcons
+ *
+ * Builds the icon index image for the current theme into ic.
+ */
+static void scanIcons(struct icons* ic, char** bases, size_t nbases, const char* key)
+{
+    struct iconBuild b;
+    memset(&b, 0, sizeof(b));
+    arena_init(&b.strings);
+    b.ntable = 256;
+    b.table = calloc(b.ntable, sizeof(uint32_t));
+    b.scanStart = time(NULL);
+
+    struct theme* themes = NULL;
+    size_t nthemes = 0, cthemes = 0;
+    addTheme(&themes, &nthemes, &cthemes, iconTheme, bases, nbases);
+    // everything falls back to hicolor
+    addTheme(&themes, &nthemes, &cthemes, "hicolor", bases, nbases);
+
+    struct stat st;
+    for(size_t i = 0; i < nthemes; ++i) {
+        struct theme* t = &themes[i];
+        for(size_t j = 0; j < nbases; ++j) {
+            char* root = malloc(strlen(bases[j]) + strlen(t->name) + 2);
+            sprintf(root, "%s/%s", bases[j], t->name);
+            if(addIconDir(&b, root, &st)) {
+                for(size_t k = 0; k < t->ndirs; ++k) {
+                    if(!t->dirs[k].listed) continue;
+                    char* dir = malloc(strlen(root) + strlen(t->dirs[k].name) + 2);
+                    sprintf(dir, "%s/%s", root, t->dirs[k].name);
+                    scanIconDir(&b, dir, i, themeDirDistance(&t->dirs[k]));
+                    free(dir);
+                }
+            }
+            free(root);
+        }
+        for(size_t k = 0; k < t->ndirs; ++k) free(t->dirs[k].name);
+        free(t->dirs);
+        free(t->inherits);
+        free(t->name);
+    }
+    free(themes);
+    // the unthemed icons come last
+    scanIconDir(&b, "/usr/share/pixmaps", nthemes, 0);
+    uint32_t keyOffset = arena_str(&b.strings, key);
+
+    // lay the image out: header, dirs, buckets, icons, strings
+    uint32_t nbuckets = 64;
+    while(nbuckets < b.nicons) nbuckets *= 2;
+    struct icons_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, ICONS_MAGIC, sizeof(h.magic));
+    h.version = ICONS_VERSION;
+    h.key = keyOffset;
+    size_t off = INDEX_ALIGN(sizeof(struct icons_header));
+    h.ndirs = b.ndirs; h.dirsOffset = off; off = INDEX_ALIGN(off + b.ndirs * sizeof(struct index_dir));
+    h.nbuckets = nbuckets; h.bucketsOffset = off; off = INDEX_ALIGN(off + nbuckets * sizeof(uint32_t));
+    h.nicons = b.nicons; h.iconsOffset = off; off = INDEX_ALIGN(off + b.nicons * sizeof(struct icon));
+    h.strtabSize = b.strings.len; h.strtabOffset = off; off += b.strings.len;
+    h.size = off;
+
+    char* image = calloc(1, off);
+    uint32_t* buckets = (uint32_t*)(image + h.bucketsOffset);
+    struct icon* out = (struct icon*)(image + h.iconsOffset);
+    memcpy(image, &h, sizeof(h));
+    if(b.ndirs) memcpy(image + h.dirsOffset, b.dirs, b.ndirs * sizeof(struct index_dir));
+    for(uint32_t i = 0; i < b.nicons; ++i) {
+        out[i] = b.icons[i];
+        out[i].next = buckets[out[i].hash % nbuckets];
+        buckets[out[i].hash % nbuckets] = i + 1;
+    }
+    memcpy(image + h.strtabOffset, b.strings.base, b.strings.len);
+    COUNT(icons, b.nicons);
+
+    free(b.strings.base);
+    free(b.dirs);
+    free(b.icons);
+    free(b.scores);
+    free(b.table);
+
+    memset(ic, 0, sizeof(struct icons));
+    if(!attachIcons(ic, image, off)) abort();
+}
+
+/**
+ * buildIcons
+ *
+ * Gets the icon index ready, if icons are wanted: from the cache if it
+ * is still good, otherwise by scanning the themes (and caching that).
+ */
+static void buildIcons()
+{
+    releaseIcons(&icons);
+    if(!iconTheme) return;
+
+    struct timing t;
+    phaseBegin(&t);
+    size_t nbases = 0;
+    char** bases = iconBaseDirs(&nbases);
+    char* key = iconKey(bases, nbases);
+    char* path = NULL;
+    if(useCache && cachePath) {
+        path = malloc(strlen(cachePath) + sizeof(ICONS_SUFFIX));
+        strcpy(path, cachePath);
+        strcat(path, ICONS_SUFFIX);
+        struct stat st;
+        void* image = mapFile(path, sizeof(struct icons_header), &st);
+        if(image) {
+            icons.mapped = 1;
+            if(!attachIcons(&icons, image, st.st_size) || !iconsAreFresh(&icons, key)) {
+                icons.image = image;
+                icons.size = st.st_size;
+                releaseIcons(&icons);
+            }
+        }
+    }
+    if(!icons.header) {
+        scanIcons(&icons, bases, nbases, key);
+        if(path) {
+            struct iovec iov;
+            iov.iov_base = icons.image;
+            iov.iov_len = icons.size;
+            writeFile(path, &iov, 1);
+        }
+    }
+    free(path);
+    free(key);
+    for(size_t i = 0; i < nbases; ++i) free(bases[i]);
+    free(bases);
+    phaseEnd(PHASE_ICONS, &t);
+}
+
+/*
+ * Executables
+ *
+ * An item with TryExec= is only shown if that program is installed: an
+ * executable file in a $PATH directory, or at the given absolute path.
+ * Rather than looking for it in every $PATH directory for every item on
+ * every run, the names of the executables in $PATH go into a hash table
+ * saved next to the menu cache, like the icon index, which remembers the
+ * mtime of each directory and is rebuilt when one changes. Checking an
+ * item is then one lookup. The menu index itself does not depend on
+ * $PATH; items are only left out when rendering.
+ */
+#define EXECS_MAGIC "jakobexe"
+#define EXECS_VERSION 1
+#define EXECS_SUFFIX ".execs"
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
 
-    // state machine:
-    // 0 - ignore everything until [Desktop Entry] is encountered
-    // 1 - extract Name, Exec etc
-    // 2 - different section, ignore
-    int foundDesktopEntry = 0;
+struct execs_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;
+    uint32_t key;       // the $PATH it was built for
+    uint32_t ndirs, dirsOffset;
+    uint32_t nbuckets, bucketsOffset;
+    uint32_t nexecs, execsOffset;
+    uint32_t strtabSize, strtabOffset;
+};
 
-    while(!feof(f) && foundDesktopEntry < 2) {
-        size_t lineCap = 128;
-        char* line = malloc(lineCap);
-        size_t lineLen = 0;
-        int c = 0;
-        line[0] = '\0';
-        // read a line
-        do {
-            c = fgetc(f);
-            if(c < 0 || feof(f) || c == '\n') break;
-            // comment -- ignore everything until end of line
-            if(c == '#') {
-                do {
-                    c = fgetc(f);
-                    if(feof(f) || c == '\n' || c < 0) break;
-                } while(!feof(f));
-                break;
+// like struct icon; dir is where in dirs it was found
+struct exec {
+    uint32_t hash;
+    uint32_t name;
+    uint32_t dir;
+    uint32_t next;
+};
+
+struct execs {
+    const struct execs_header* header;
+    const struct index_dir* dirs;
+    const uint32_t* buckets;
+    const struct exec* execs;
+    const char* strtab;
+    void* image;
+    size_t size;
+    int mapped;
+};
+
+static struct execs execs;
+
+static int attachExecs(struct execs* ex, void* image, size_t size)
+{
+    const struct execs_header* h = (const struct execs_header*)image;
+    if(size < sizeof(struct execs_header)) return 0;
+    if(memcmp(h->magic, EXECS_MAGIC, sizeof(h->magic)) != 0) return 0;
+    if(h->version != EXECS_VERSION) return 0;
+    if(h->size != size) return 0;
+    CHECK_TABLE(h->ndirs, h->dirsOffset, struct index_dir);
+    CHECK_TABLE(h->nbuckets, h->bucketsOffset, uint32_t);
+    CHECK_TABLE(h->nexecs, h->execsOffset, struct exec);
+    CHECK_TABLE(h->strtabSize, h->strtabOffset, char);
+    if(h->strtabSize == 0 || h->nbuckets == 0
+            || ((const char*)image)[h->strtabOffset + h->strtabSize - 1] != '\0'
+            || h->key >= h->strtabSize)
+        return 0;
+
+    ex->header = h;
+    ex->dirs = (const struct index_dir*)((char*)image + h->dirsOffset);
+    ex->buckets = (const uint32_t*)((char*)image + h->bucketsOffset);
+    ex->execs = (const struct exec*)((char*)image + h->execsOffset);
+    ex->strtab = (const char*)image + h->strtabOffset;
+    ex->image = image;
+    ex->size = size;
+
+    for(uint32_t i = 0; i < h->ndirs; ++i)
+        if(ex->dirs[i].path >= h->strtabSize) return 0;
+    for(uint32_t i = 0; i < h->nbuckets; ++i)
+        if(ex->buckets[i] > h->nexecs) return 0;
+    for(uint32_t i = 0; i < h->nexecs; ++i) {
+        const struct exec* e = &ex->execs[i];
+        if(e->name >= h->strtabSize || e->dir >= h->ndirs || e->next > i)
+            return 0;
+    }
+    return 1;
+}
+
+static void releaseExecs(struct execs* ex)
+{
+    if(ex->image) {
+        if(ex->mapped) munmap(ex->image, ex->size);
+        else free(ex->image);
+    }
+    memset(ex, 0, sizeof(struct execs));
+}
+
+// name, of len bytes, is in dirs[dir]; any directory if dir is -1
+static int hasExec(const struct execs* ex, const char* name, size_t len, int64_t dir)
+{
+    uint32_t hash = hashBytes(name, len);
+    uint32_t i = ex->buckets[hash % ex->header->nbuckets];
+    while(i) {
+        const struct exec* e = &ex->execs[i - 1];
+        const char* execName = INDEX_STR(ex, e->name);
+        if(e->hash == hash && (dir < 0 || e->dir == dir)
+                && strncmp(execName, name, len) == 0 && execName[len] == '\0')
+            return 1;
+        i = e->next;
+    }
+    return 0;
+}
+
+/**
+ * findExec
+ *
+ * Checks TryExec= value tryExec. An absolute path outside of $PATH
+ * costs an access(2); anything else is a lookup.
+ *
+ * @returns 1 if it is installed
+ */
+static int findExec(const struct execs* ex, const char* tryExec)
+{
+    if(!ex->header) return 1;
+    const char* slash = strrchr(tryExec, '/');
+    if(!slash) return hasExec(ex, tryExec, strlen(tryExec), -1);
+    if(*tryExec == '/') {
+        size_t dirLen = slash - tryExec;
+        for(uint32_t i = 0; i < ex->header->ndirs; ++i) {
+            const char* dir = INDEX_STR(ex, ex->dirs[i].path);
+            if(strncmp(dir, tryExec, dirLen) == 0 && dir[dirLen] == '\0')
+                return hasExec(ex, slash + 1, strlen(slash + 1), i);
+        }
+    }
+    return access(tryExec, X_OK) == 0;
+}
+
+// whether item, in layer, goes into the menu
+static inline int isInstalled(const struct index* layer, const struct item* item)
+{
+    return !item->TryExec || findExec(&execs, INDEX_STR(layer, item->TryExec));
+}
+
+static int execsAreFresh(const struct execs* ex, const char* key)
+{
+    if(strcmp(INDEX_STR(ex, ex->header->key), key) != 0) return 0;
+    for(uint32_t i = 0; i < ex->header->ndirs; ++i) {
+        const struct index_dir* d = &ex->dirs[i];
+        struct stat st;
+        int exists = stat(INDEX_STR(ex, d->path), &st) == 0;
+        if(exists != (int)d->exists) return 0;
+        if(!exists) continue;
+        if(d->mtimeSec != st.st_mtim.tv_sec || d->mtimeNsec != st.st_mtim.tv_nsec)
+            return 0;
+    }
+    return 1;
+}
+
+// what the index is built for; relative directories in it are ignored
+static const char* execsKey()
+{
+    const char* path = getenv("PATH");
+    return path && *path ? path : DEFAULT_PATH;
+}
+
+/**
+ * scanExecs
+ *
+ * Builds the executable index image for $PATH, as given by key, into ex.
+ */
+static void scanExecs(struct execs* ex, const char* key)
+{
+    struct arena names;
+    arena_init(&names);
+    struct index_dir* dirs = NULL;
+    uint32_t ndirs = 0, cdirs = 0;
+    struct exec* found = NULL;
+    uint32_t nfound = 0, cfound = 0;
+    time_t scanStart = time(NULL);
+
+    char* path = strdup(key);
+    char* save = NULL;
+    for(char* dir = strtok_r(path, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+        if(*dir != '/') continue;
+        int seen = 0;
+        for(uint32_t i = 0; i < ndirs && !seen; ++i)
+            seen = strcmp(names.base + dirs[i].path, dir) == 0;
+        if(seen) continue;
+
+        // remember it as it is now, so the index goes stale when it changes
+        struct index_dir d;
+        memset(&d, 0, sizeof(d));
+        d.path = arena_str(&names, dir);
+        struct stat st;
+        int fd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if(fd >= 0 && fstat(fd, &st) == 0) {
+            d.exists = 1;
+            d.mtimeSec = st.st_mtim.tv_sec;
+            d.mtimeNsec = st.st_mtim.tv_nsec;
+            // see parseAll
+            if(st.st_mtim.tv_sec >= scanStart) d.mtimeSec = -1;
+        }
+        APPEND(dirs, ndirs, cdirs, d);
+        if(fd < 0) continue;
+
+        struct dirScan scan;
+        if(d.exists && dirScanOpen(&scan, fd)) {
+            const char* name;
+            size_t len;
+            unsigned char type;
+            while((name = dirScanNext(&scan, &len, &type)) != NULL) {
+                if(!mayBeFile(type)) continue;
+                if(fstatat(fd, name, &st, 0) != 0
+                        || !S_ISREG(st.st_mode) || !(st.st_mode & 0111))
+                    continue;
+                struct exec e;
+                e.hash = hashBytes(name, len);
+                e.name = arena_add(&names, name, len);
+                e.dir = ndirs - 1;
+                e.next = 0;
+                APPEND(found, nfound, cfound, e);
             }
-            line[lineLen++] = (c & 0xFF);
-            if(lineLen >= lineCap - 1/*terminator*/) {
-                lineCap *= 2;
-                line = realloc(line, lineCap);
+            dirScanClose(&scan);
+        }
+        close(fd);
+    }
+    free(path);
+    uint32_t keyOffset = arena_str(&names, key);
+
+    // lay the image out: header, dirs, buckets, execs, strings
+    uint32_t nbuckets = 64;
+    while(nbuckets < nfound) nbuckets *= 2;
+    struct execs_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EXECS_MAGIC, sizeof(h.magic));
+    h.version = EXECS_VERSION;
+    h.key = keyOffset;
+    size_t off = INDEX_ALIGN(sizeof(struct execs_header));
+    h.ndirs = ndirs; h.dirsOffset = off; off = INDEX_ALIGN(off + ndirs * sizeof(struct index_dir));
+    h.nbuckets = nbuckets; h.bucketsOffset = off; off = INDEX_ALIGN(off + nbuckets * sizeof(uint32_t));
+    h.nexecs = nfound; h.execsOffset = off; off = INDEX_ALIGN(off + nfound * sizeof(struct exec));
+    h.strtabSize = names.len; h.strtabOffset = off; off += names.len;
+    h.size = off;
+
+    char* image = calloc(1, off);
+    uint32_t* buckets = (uint32_t*)(image + h.bucketsOffset);
+    struct exec* out = (struct exec*)(image + h.execsOffset);
+    memcpy(image, &h, sizeof(h));
+    if(ndirs) memcpy(image + h.dirsOffset, dirs, ndirs * sizeof(struct index_dir));
+    for(uint32_t i = 0; i < nfound; ++i) {
+        out[i] = found[i];
+        out[i].next = buckets[out[i].hash % nbuckets];
+        buckets[out[i].hash % nbuckets] = i + 1;
+    }
+    memcpy(image + h.strtabOffset, names.base, names.len);
+    COUNT(execs, nfound);
+
+    free(names.base);
+    free(dirs);
+    free(found);
+
+    memset(ex, 0, sizeof(struct execs));
+    if(!attachExecs(ex, image, off)) abort();
+}
+
+// whether any item of idx, or of the shared index under it, has a TryExec
+static int wantsExecs(const struct index* idx)
+{
+    for(; idx; idx = idx->base)
+        for(uint32_t i = 0; i < idx->header->nitems; ++i)
+            if(idx->items[i].TryExec) return 1;
+    return 0;
+}
+
+/**
+ * buildExecs
+ *
+ * Gets the executable index ready, if idx needs one: from the cache if
+ * it is still good, otherwise by scanning $PATH (and caching that).
+ */
+static void buildExecs(const struct index* idx)
+{
+    releaseExecs(&execs);
+    // --shared-index renders nothing, and each user has a $PATH and an
+    // executable index of their own
+    if(indexingShared || !wantsExecs(idx)) return;
+
+    struct timing t;
+    phaseBegin(&t);
+    const char* key = execsKey();
+    char* path = NULL;
+    if(useCache && cachePath) {
+        path = malloc(strlen(cachePath) + sizeof(EXECS_SUFFIX));
+        strcpy(path, cachePath);
+        strcat(path, EXECS_SUFFIX);
+        struct stat st;
+        void* image = mapFile(path, sizeof(struct execs_header), &st);
+        if(image) {
+            execs.mapped = 1;
+            if(!attachExecs(&execs, image, st.st_size) || !execsAreFresh(&execs, key)) {
+                execs.image = image;
+                execs.size = st.st_size;
+                releaseExecs(&execs);
             }
-        } while(!feof(f));
-        // add terminator
-        line[lineLen] = '\0';
+        }
+    }
+    if(!execs.header) {
+        scanExecs(&execs, key);
+        if(path) {
+            struct iovec iov;
+            iov.iov_base = execs.image;
+            iov.iov_len = execs.size;
+            writeFile(path, &iov, 1);
+        }
+    }
+    free(path);
+    phaseEnd(PHASE_EXECS, &t);
+}
+
+/*
+ * Output
+ *
+ * Output is rendered into buffers sized up front from the index: the
+ * whole menu into one per category (see render), so that they can be
+ * filled in parallel, the rest into one. Either way it is handed to
+ * writev(2) in one go. Every string that comes from a .desktop file is
+ * XML-escaped on the way in.
+ */
+struct outbuf {
+    char* buf;
+    size_t len, cap;
+};
+
+static void out_reserve(struct outbuf* o, size_t n)
+{
+    if(o->len + n <= o->cap) return;
+    while(o->len + n > o->cap) o->cap = o->cap ? o->cap * 2 : 4096;
+    o->buf = realloc(o->buf, o->cap);
+    COUNT(allocations, 1);
+}
+
+static inline void out_append(struct outbuf* o, const char* s, size_t n)
+{
+    out_reserve(o, n);
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+#define OUT_LITERAL(O, S) out_append((O), (S), sizeof(S) - 1)
+
+/**
+ * out_escaped
+ *
+ * Appends s with & < > " ' replaced by entities. strcspn() finds the next
+ * character that needs escaping, and libcs vectorize it, so runs of
+ * plain text are copied in bulk.
+ */
+static void out_escaped(struct outbuf* o, const char* s)
+{
+    for(;;) {
+        size_t n = strcspn(s, "&<>\"'");
+        out_append(o, s, n);
+        s += n;
+        switch(*s) {
+            case '\0': return;
+            case '&': OUT_LITERAL(o, "&amp;"); break;
+            case '<': OUT_LITERAL(o, "&lt;"); break;
+            case '>': OUT_LITERAL(o, "&gt;"); break;
+            case '"': OUT_LITERAL(o, "&quot;"); break;
+            case '\'': OUT_LITERAL(o, "&apos;"); break;
+        }
+        ++s;
+    }
+}
+
+// writes all of o to fd
+static int out_flush(struct outbuf* o, int fd)
+{
+    struct iovec iov = { o->buf, o->len };
+    if(!writevAll(fd, &iov, 1)) return 0;
+    o->len = 0;
+    return 1;
+}
+
+// a rendered menu: the head, one part per category in order, the tail
+struct output {
+    struct outbuf* parts;
+    size_t nparts;
+};
+
+static void output_init(struct output* out, size_t nparts)
+{
+    out->parts = calloc(nparts, sizeof(struct outbuf));
+    out->nparts = nparts;
+    COUNT(allocations, 1);
+}
+
+static void output_free(struct output* out)
+{
+    for(size_t i = 0; i < out->nparts; ++i)
+        free(out->parts[i].buf);
+    free(out->parts);
+    memset(out, 0, sizeof(struct output));
+}
+
+// writes all parts of out to fd, joined
+static int output_write(const struct output* out, int fd)
+{
+    struct iovec* iov = malloc((out->nparts ? out->nparts : 1) * sizeof(struct iovec));
+    int niov = 0;
+    for(size_t i = 0; i < out->nparts; ++i) {
+        if(!out->parts[i].len) continue;
+        iov[niov].iov_base = out->parts[i].buf;
+        iov[niov].iov_len = out->parts[i].len;
+        ++niov;
+    }
+    int ok = writevAll(fd, iov, niov);
+    free(iov);
+    return ok;
+}
+
+#define TERMINAL_PREFIX "xterm -e "
+
+static const char itemHead[] = "  <item label=\"";
+static const char itemIcon[] = "\" icon=\"";
+static const char itemMid[] = "\"><action name=\"Execute\"><execute>";
+static const char itemTail[] = "</execute></action></item>\n";
+
+/**
+ * indexItem
+ *
+ * Looks up item number i, which is in the shared index under idx if
+ * there is one and i is low enough (see Shared index).
+ *
+ * layer    set to the index the item and its strings are in
+ */
+static inline const struct item* indexItem(const struct index* idx, uint32_t i, const struct index** layer)
+{
+    if(idx->base) {
+        if(i < idx->header->baseItems) {
+            *layer = idx->base;
+            return &idx->base->items[i];
+        }
+        i -= idx->header->baseItems;
+    }
+    *layer = idx;
+    return &idx->items[i];
+}
+
+// a good guess of how big category's items come out: exact unless
+// escaping kicks in
+static size_t renderSize(const struct index* idx, const struct category* category)
+{
+    size_t size = 0;
+    for(uint32_t j = 0; j < category->count; ++j) {
+        const struct index* layer;
+        const struct item* item = indexItem(idx, idx->members[category->first + j], &layer);
+        size += sizeof(itemHead) + sizeof(itemMid) + sizeof(itemTail)
+            + sizeof(TERMINAL_PREFIX)
+            + strlen(INDEX_STR(layer, item->Name))
+            + strlen(INDEX_STR(layer, item->Exec));
+        // no use looking the icon up twice; guess
+        if(icons.header) size += sizeof(itemIcon) + 64;
+    }
+    return size;
+}
+
+static void renderItem(const struct index* idx, const struct item* item, struct outbuf* o)
+{
+    OUT_LITERAL(o, itemHead);
+    out_escaped(o, INDEX_STR(idx, item->Name));
+    const char* icon = iconTheme ? findIcon(&icons, INDEX_STR(idx, item->Icon)) : NULL;
+    if(icon) {
+        OUT_LITERAL(o, itemIcon);
+        out_escaped(o, icon);
+    }
+    OUT_LITERAL(o, itemMid);
+    if(item->useTerminal) OUT_LITERAL(o, TERMINAL_PREFIX);
+    out_escaped(o, INDEX_STR(idx, item->Exec));
+    OUT_LITERAL(o, itemTail);
+}
+
+// renders the items of category that are installed; returns how many
+static uint32_t renderItems(const struct index* idx, const struct category* category, struct outbuf* o)
+{
+    uint32_t shown = 0;
+    for(uint32_t j = 0; j < category->count; ++j) {
+        const struct index* layer;
+        const struct item* item = indexItem(idx, idx->members[category->first + j], &layer);
+        if(!isInstalled(layer, item)) {
+            COUNT(notInstalled, 1);
+            continue;
+        }
+        renderItem(layer, item, o);
+        ++shown;
+    }
+    return shown;
+}
+
+// whether category i, or any menu nested in it, has an item that is
+// installed
+static int hasInstalled(const struct index* idx, uint32_t i)
+{
+    const struct category* category = &idx->categories[i];
+    for(uint32_t j = 0; j < category->count; ++j) {
+        const struct index* layer;
+        const struct item* item = indexItem(idx, idx->members[category->first + j], &layer);
+        if(isInstalled(layer, item)) return 1;
+    }
+    for(uint32_t j = 0; j < idx->header->ncategories; ++j)
+        if(idx->categories[j].parent == i + 1 && hasInstalled(idx, j)) return 1;
+    return 0;
+}
+
+// renderSize for category i and the menus nested in it
+static size_t treeSize(const struct index* idx, uint32_t i)
+{
+    const struct category* category = &idx->categories[i];
+    size_t size = 32 + 2 * strlen(INDEX_STR(idx, category->name)) + renderSize(idx, category);
+    for(uint32_t j = 0; j < idx->header->ncategories; ++j)
+        if(idx->categories[j].parent == i + 1) size += treeSize(idx, j);
+    return size;
+}
+
+static int renderMenu(const struct index* idx, uint32_t i, struct outbuf* o);
+
+// renders the menus nested in category i, then its items; returns
+// whether anything was rendered
+static int renderContents(const struct index* idx, uint32_t i, struct outbuf* o)
+{
+    int shown = 0;
+    for(uint32_t j = 0; j < idx->header->ncategories; ++j)
+        if(idx->categories[j].parent == i + 1 && renderMenu(idx, j, o)) shown = 1;
+    if(renderItems(idx, &idx->categories[i], o)) shown = 1;
+    return shown;
+}
+
+// the menu header of category i, less the closing of the tag
+static void renderMenuHead(const struct index* idx, uint32_t i, struct outbuf* o)
+{
+    const struct category* category = &idx->categories[i];
+    OUT_LITERAL(o, " <menu id=\"");
+    out_escaped(o, INDEX_STR(idx, category->name));
+    OUT_LITERAL(o, "\" label=\"");
+    out_escaped(o, INDEX_STR(idx, category->label ? category->label : category->name));
+}
+
+// renders category i as a menu; nothing if none of it is installed
+static int renderMenu(const struct index* idx, uint32_t i, struct outbuf* o)
+{
+    size_t start = o->len;
+    renderMenuHead(idx, i, o);
+    OUT_LITERAL(o, "\">\n");
+    if(!renderContents(idx, i, o)) {
+        o->len = start;
+        return 0;
+    }
+    OUT_LITERAL(o, " </menu>\n");
+    return 1;
+}
+
+// appends s quoted for the shell-like splitting Openbox does on execute=
+static void out_shellQuoted(struct outbuf* o, const char* s)
+{
+    OUT_LITERAL(o, "'");
+    for(;;) {
+        size_t n = strcspn(s, "'");
+        out_append(o, s, n);
+        s += n;
+        if(!*s) break;
+        OUT_LITERAL(o, "'\\''");
+        ++s;
+    }
+    OUT_LITERAL(o, "'");
+}
+
+// below this many items, threads cost more than they save
+#define PARALLEL_RENDER_MIN 2048
+
+struct renderJob {
+    const struct index* idx;
+    struct outbuf* parts;   // one per category
+};
+
+// renders top level category i into its own part; nothing if none of
+// it is installed
+static void renderPart(void* ctx, uint32_t i)
+{
+    const struct renderJob* job = (const struct renderJob*)ctx;
+    const struct index* idx = job->idx;
+    const struct category* category = &idx->categories[i];
+    struct outbuf* o = &job->parts[i];
+    if(category->parent) return;
+    if(!lazyMenus) {
+        out_reserve(o, treeSize(idx, i));
+        renderMenu(idx, i, o);
+        return;
+    }
+    if(!hasInstalled(idx, i)) return;
+
+    const char* name = INDEX_STR(idx, category->name);
+    out_reserve(o, 64 + 2 * strlen(subMenuCommand) + 4 * strlen(name));
+    renderMenuHead(idx, i, o);
+    struct outbuf command;
+    memset(&command, 0, sizeof(command));
+    out_append(&command, subMenuCommand, strlen(subMenuCommand));
+    OUT_LITERAL(&command, " -C ");
+    out_shellQuoted(&command, name);
+    out_append(&command, "", 1);
+    OUT_LITERAL(o, "\" execute=\"");
+    out_escaped(o, command.buf);
+    OUT_LITERAL(o, "\"/>\n");
+    free(command.buf);
+}
+
+/**
+ * render
+ *
+ * Renders the whole menu into out, a part per category (see Category
+ * pool); with -l, the top level only, where each category is a pipe
+ * menu of its own that runs subMenuCommand -C NAME.
+ */
+static void render(const struct index* idx, struct output* out)
+{
+    uint32_t ncategories = idx->header->ncategories;
+    output_init(out, ncategories + 2);
+    OUT_LITERAL(&out->parts[0], "<openbox_pipe_menu>\n");
+
+    struct renderJob job;
+    job.idx = idx;
+    job.parts = out->parts + 1;
+    forEachCategory(idx->categories, ncategories, &renderPart, &job,
+            !lazyMenus && idx->header->nmembers >= PARALLEL_RENDER_MIN);
+
+    OUT_LITERAL(&out->parts[ncategories + 1], "</openbox_pipe_menu>\n");
+}
+
+/**
+ * renderCategory
+ *
+ * Renders what -C asks for: the items of category name, if there is one
+ * by that name.
+ */
+static void renderCategory(const struct index* idx, const char* name, struct outbuf* o)
+{
+    const struct category* category = NULL;
+    // there are only ever a few dozen categories
+    for(uint32_t i = 0; i < idx->header->ncategories; ++i) {
+        if(strcmp(INDEX_STR(idx, idx->categories[i].name), name) == 0) {
+            category = &idx->categories[i];
+            break;
+        }
+    }
+    uint32_t i = category ? (uint32_t)(category - idx->categories) : 0;
+    out_reserve(o, 64 + (category ? treeSize(idx, i) : 0));
+    OUT_LITERAL(o, "<openbox_pipe_menu>\n");
+    if(category) renderContents(idx, i, o);
+    OUT_LITERAL(o, "</openbox_pipe_menu>\n");
+}
+
+/*
+ * Search
+ *
+ * jakobmenu -s QUERY prints the items that match QUERY, best first. An
+ * item matches if each word of the query is in its Name, GenericName,
+ * Keywords or Exec, ignoring (ASCII) case; each item keeps those
+ * lowercased in one search text (see searchText), one per line.
+ *
+ * So that a search never has to look at every item, the index has a
+ * trigram index over the search texts: every three-byte sequence in
+ * them, sorted, with the (ascending) indices of the items it occurs in.
+ * A word can only be in items that have all of its trigrams, so the
+ * candidates are the intersection of a few short posting lists, found
+ * by binary search; only they are checked for real and ranked. Words
+ * shorter than three bytes have no trigrams and are only checked.
+ */
+static inline uint32_t gramKey(const char* p)
+{
+    return ((uint32_t)(unsigned char)p[0] << 16)
+        | ((uint32_t)(unsigned char)p[1] << 8)
+        | (uint32_t)(unsigned char)p[2];
+}
+
+// a trigram can't span fields
+static inline int isGram(const char* p)
+{
+    return p[0] != '\n' && p[1] != '\n' && p[2] != '\n';
+}
+
+/**
+ * buildGrams
+ *
+ * Builds grams and postings over the items. Every (trigram, item) pair
+ * is radix sorted by trigram; the sort is stable and the pairs are
+ * made in item order, so each posting list comes out sorted too.
+ */
+static void buildGrams()
+{
+    size_t npairs = 0, cpairs = 0;
+    for(uint32_t i = 0; i < nitems; ++i) {
+        size_t len = strlen(STR(items[i].search));
+        if(len >= 3) cpairs += len - 2;
+    }
+    // as many as there could be; the pages nobody touches cost nothing
+    uint64_t* pairs = malloc((cpairs ? cpairs : 1) * sizeof(uint64_t));
+    COUNT(allocations, 1);
+    // the trigrams seen in the current item: a slot is taken if its
+    // stamp is the item's index + 1, so it never needs clearing
+    struct { uint32_t key, stamp; }* seen = NULL;
+    size_t nseen = 0;
+    for(uint32_t i = 0; i < nitems; ++i) {
+        const char* text = STR(items[i].search);
+        size_t len = strlen(text);
+        if(len < 3) continue;
+        if(2 * len > nseen) {
+            free(seen);
+            nseen = 1024;
+            while(nseen < 2 * len) nseen *= 2;
+            seen = calloc(nseen, sizeof(*seen));
+            COUNT(allocations, 1);
+        }
+        for(size_t j = 0; j + 3 <= len; ++j) {
+            if(!isGram(text + j)) continue;
+            uint32_t key = gramKey(text + j);
+            size_t k = (key * 2654435761u) & (nseen - 1);
+            while(seen[k].stamp == i + 1 && seen[k].key != key) k = (k + 1) & (nseen - 1);
+            // each trigram is posted once per item, however often it's in there
+            if(seen[k].stamp == i + 1) continue;
+            seen[k].key = key;
+            seen[k].stamp = i + 1;
+            pairs[npairs++] = ((uint64_t)key << 32) | (nbaseItems + i);
+        }
+    }
+    free(seen);
+    uint64_t* sorted = malloc((npairs ? npairs : 1) * sizeof(uint64_t));
+    COUNT(allocations, 1);
+    // the key is in bits 32-55; two passes of 12 bits each
+    size_t* counts = malloc(4096 * sizeof(size_t));
+    for(int shift = 32; shift < 56; shift += 12) {
+        memset(counts, 0, 4096 * sizeof(size_t));
+        for(size_t i = 0; i < npairs; ++i) counts[(pairs[i] >> shift) & 0xFFF]++;
+        size_t pos = 0;
+        for(int b = 0; b < 4096; ++b) {
+            size_t n = counts[b];
+            counts[b] = pos;
+            pos += n;
+        }
+        for(size_t i = 0; i < npairs; ++i)
+            sorted[counts[(pairs[i] >> shift) & 0xFFF]++] = pairs[i];
+        uint64_t* swap = pairs;
+        pairs = sorted;
+        sorted = swap;
+    }
+    free(counts);
+
+    free(grams);
+    free(postings);
+    grams = malloc((npairs ? npairs : 1) * sizeof(struct gram));
+    postings = malloc((npairs ? npairs : 1) * sizeof(uint32_t));
+    COUNT(allocations, 2);
+    ngrams = npostings = 0;
+    for(size_t i = 0; i < npairs; ++i) {
+        uint32_t key = (uint32_t)(pairs[i] >> 32);
+        if(!ngrams || grams[ngrams - 1].key != key) {
+            grams[ngrams].key = key;
+            grams[ngrams].first = npostings;
+            grams[ngrams].count = 0;
+            ngrams++;
+        }
+        postings[npostings++] = (uint32_t)pairs[i];
+        grams[ngrams - 1].count++;
+    }
+    free(pairs);
+    free(sorted);
+}
+
+// @returns the gram for key, or NULL if no item has it (or it is broken)
+static const struct gram* findGram(const struct index* idx, uint32_t key)
+{
+    uint32_t lo = 0, hi = idx->header->ngrams;
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(idx->grams[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == idx->header->ngrams || idx->grams[lo].key != key) return NULL;
+    const struct gram* g = &idx->grams[lo];
+    if(g->first > idx->header->npostings || g->count > idx->header->npostings - g->first)
+        return NULL;
+    return g;
+}
+
+static int compare_grams(const void* left, const void* right)
+{
+    const struct gram* l = *(const struct gram* const*)left;
+    const struct gram* r = *(const struct gram* const*)right;
+    return l->count < r->count ? -1 : l->count > r->count;
+}
+
+/**
+ * scoreWord
+ *
+ * Finds word in an item's search text.
+ *
+ * @returns how well it matches, lower is better: the field it was found
+ *          in counts most, then whether it is at the start of that field,
+ *          of a word, or neither; -1 if it isn't there
+ */
+static int scoreWord(const char* text, const char* word)
+{
+    int best = -1;
+    for(const char* p = strstr(text, word); p; p = strstr(p + 1, word)) {
+        int field = 0;
+        const char* start = text;
+        for(const char* q = text; q < p; ++q)
+            if(*q == '\n') {
+                field++;
+                start = q + 1;
+            }
+        int score = 4 * field;
+        if(p != start) score += isalnum((unsigned char)p[-1]) ? 2 : 1;
+        if(best < 0 || score < best) best = score;
+        // nothing after this can be better
+        if(score % 4 == 0) break;
+    }
+    return best;
+}
+
+struct match {
+    int score;
+    uint32_t item;
+    const char* name;
+};
+
+static int compare_matches(const void* left, const void* right)
+{
+    const struct match* l = (const struct match*)left;
+    const struct match* r = (const struct match*)right;
+    if(l->score != r->score) return l->score < r->score ? -1 : 1;
+    int c = strcmp(l->name, r->name);
+    if(c) return c;
+    return l->item < r->item ? -1 : l->item > r->item;
+}
+
+static int compare_uint32(const void* left, const void* right)
+{
+    uint32_t l = *(const uint32_t*)left, r = *(const uint32_t*)right;
+    return l < r ? -1 : l > r;
+}
+
+/**
+ * findMatches
+ *
+ * Adds the items of layer (idx itself, or the shared index under it)
+ * which match all nwords words to matches.
+ */
+static void findMatches(const struct index* idx, const struct index* layer,
+        char** word, size_t nwords,
+        struct match** matches, size_t* nmatches, size_t* cmatches)
+{
+    // our items come after the shared ones, and so do their postings
+    const uint32_t first = layer == idx && idx->base ? idx->header->baseItems : 0;
+    const uint32_t count = layer->header->nitems;
 
-        // see foundDesktopEntry
-        switch(sectionType(line)) {
-            default:
-            case 0:
-                break;
-            case 1:
-                foundDesktopEntry = 1;
-                break;
-            case 2:
-                if(foundDesktopEntry) {
-                    foundDesktopEntry = 2;
-                }
-                break;
+    // every trigram of every word, rarest first
+    const struct gram** needed = NULL;
+    size_t nneeded = 0, cneeded = 0;
+    for(size_t i = 0; i < nwords; ++i) {
+        for(const char* p = word[i]; p[0] && p[1] && p[2]; ++p) {
+            const struct gram* g = findGram(layer, gramKey(p));
+            // some trigram is in no item at all
+            if(!g) {
+                free(needed);
+                return;
+            }
+            APPEND(needed, nneeded, cneeded, g);
         }
+    }
+    qsort(needed, nneeded, sizeof(const struct gram*), &compare_grams);
 
-        // parse statements
-        char *key = NULL, *value = NULL;
-        if(foundDesktopEntry == 1 && splitByEquals(line, &key, &value)) {
-            if(strcmp(key, "Type") == 0) {
-                isOk = isOk && (strcmp(value, "Application") == 0);
-            } else if(strcmp(key, "Hidden") == 0) {
-                isOk = isOk && (strcmp(value, "true") != 0);
-            } else if(strcmp(key, "NoDisplay") == 0) {
-                isOk = isOk && (strcmp(value, "true") != 0);
-            } else if(strcmp(key, "Name") == 0) {
-                Name = strdup(value);
-            } else if(strcmp(key, "Icon") == 0) {
-                Icon = strdup(value);
-            } else if(strcmp(key, "Exec") == 0) {
-                char* ss = NULL;
-                Exec = strdup(value);
-                // strip %U, %u, %f, openbox cannot provide that
-                while((ss = strstr(Exec, "%U")) != NULL) {
-                    ss[0] = ' ';
-                    ss[1] = ' ';
-                }
-                while((ss = strstr(Exec, "%u")) != NULL) {
-                    ss[0] = ' ';
-                    ss[1] = ' ';
-                }
-                while((ss = strstr(Exec, "%F")) != NULL) {
-                    ss[0] = ' ';
-                    ss[1] = ' ';
-                }
-                while((ss = strstr(Exec, "%f")) != NULL) {
-                    ss[0] = ' ';
-                    ss[1] = ' ';
+    // the candidates: everything, or the items which have every trigram
+    uint32_t* candidates = NULL;
+    size_t ncandidates = 0;
+    if(nneeded == 0) {
+        candidates = malloc((count ? count : 1) * sizeof(uint32_t));
+        for(uint32_t i = 0; i < count; ++i) candidates[ncandidates++] = first + i;
+    } else {
+        const struct gram* g = needed[0];
+        candidates = malloc((g->count ? g->count : 1) * sizeof(uint32_t));
+        memcpy(candidates, layer->postings + g->first, g->count * sizeof(uint32_t));
+        ncandidates = g->count;
+        for(size_t i = 1; i < nneeded && ncandidates; ++i) {
+            // both lists are sorted; binary search for each candidate
+            // in what is left of the longer one
+            const uint32_t* list = layer->postings + needed[i]->first;
+            uint32_t lo = 0, n = needed[i]->count;
+            size_t kept = 0;
+            for(size_t j = 0; j < ncandidates; ++j) {
+                uint32_t hi = n;
+                while(lo < hi) {
+                    uint32_t mid = lo + (hi - lo) / 2;
+                    if(list[mid] < candidates[j]) lo = mid + 1;
+                    else hi = mid;
                 }
-            } else if(strcmp(key, "Categories") == 0) {
-                Categories = strdup(value);
-            } else if(strcmp(key, "Path") == 0) {
-                Path = strdup(value);
-            } else if(strcmp(key, "Terminal") == 0) {
-                useTerminal = (strcmp(value, "true") == 0);
+                if(lo < n && list[lo] == candidates[j]) candidates[kept++] = candidates[j];
             }
+            ncandidates = kept;
         }
+    }
 
-        free(line);
+    // check and rank them
+    for(size_t i = 0; i < ncandidates; ++i) {
+        if(candidates[i] < first || candidates[i] - first >= count) continue;
+        // hidden by one of ours
+        if(layer != idx && idx->header->nshadowed && bsearch(&candidates[i], idx->shadowed,
+                    idx->header->nshadowed, sizeof(uint32_t), &compare_uint32))
+            continue;
+        const struct item* item = &layer->items[candidates[i] - first];
+        const char* text = INDEX_STR(layer, item->search);
+        int score = 0;
+        for(size_t j = 0; j < nwords && score >= 0; ++j) {
+            int s = scoreWord(text, word[j]);
+            score = s < 0 ? -1 : score + s;
+        }
+        if(score < 0 || !isInstalled(layer, item)) continue;
+        struct match m;
+        m.score = score;
+        m.item = candidates[i];
+        m.name = INDEX_STR(layer, item->Name);
+        APPEND(*matches, *nmatches, *cmatches, m);
     }
 
-    // if we're ok and we have at least Name and Exec...
-    isOk = isOk && Name && Exec;
-
-    if(isOk) {
-        // grab first category
-        char* foundSemicolon = Categories ? strchr(Categories, ';') : NULL;
-        if(foundSemicolon) *foundSemicolon = '\0';
-        // create a menu item
-        struct item* item = new_item(Name, Exec, Categories, Icon, Path, useTerminal);
-        // add it to its main categories
-        struct category* category = get_category(item->Category);
-        if(!category) {
-            category = append_category(item->Category);
-        }
-        ADD_MEMBER(category, item);
-
-        if(useAllCategories) {
-            // also add it to all other categories
-            while(foundSemicolon != NULL) {
-                char* base = foundSemicolon + 1;
-                foundSemicolon = strchr(base, ';');
-                if(foundSemicolon) {
-                    *foundSemicolon = '\0';
-                }
-                // skip over BS
-                if(strlen(base) == 0) continue;
-                if(strstr(base, "X-") == base) continue;
-                if(strstr(base, "x-") == base) continue;
-                category = get_category(base);
-                if(!category) {
-                    category = append_category(base);
-                }
-                ADD_MEMBER(category, item);
-            }
+    free(candidates);
+    free(needed);
+}
+
+/**
+ * renderSearch
+ *
+ * Renders the items matching query, best match first.
+ */
+static void renderSearch(const struct index* idx, const char* query, struct outbuf* o)
+{
+    // lowercase the query and split it into words
+    char* words = strdup(query);
+    char** word = NULL;
+    size_t nwords = 0, cwords = 0;
+    for(char* p = words; *p; ++p)
+        if(*p >= 'A' && *p <= 'Z') *p = *p - 'A' + 'a';
+    for(char* w = strtok(words, " \t\n"); w; w = strtok(NULL, " \t\n"))
+        APPEND(word, nwords, cwords, w);
+
+    struct match* matches = NULL;
+    size_t nmatches = 0, cmatches = 0;
+    if(idx->base) findMatches(idx, idx->base, word, nwords, &matches, &nmatches, &cmatches);
+    findMatches(idx, idx, word, nwords, &matches, &nmatches, &cmatches);
+    qsort(matches, nmatches, sizeof(struct match), &compare_matches);
+
+    OUT_LITERAL(o, "<openbox_pipe_menu>\n");
+    for(size_t i = 0; i < nmatches; ++i) {
+        const struct index* layer;
+        const struct item* item = indexItem(idx, matches[i].item, &layer);
+        renderItem(layer, item, o);
+    }
+    OUT_LITERAL(o, "</openbox_pipe_menu>\n");
+
+    free(matches);
+    free(word);
+    free(words);
+}
+
+/*
+ * Rebuilds
+ *
+ * When a path= directory changes, every jakobmenu started before the
+ * index is saved again finds it stale, and Openbox alone may start a few
+ * at once. So a rebuild takes an flock(2) on the index's .lock file: the
+ * first one in rebuilds, and the others wait for it, up to
+ * REBUILD_WAIT_MS, then load what it saved. One that gives up waiting
+ * makes do with the previous index, if that is a menu for the same
+ * options and directories, or builds the menu without saving it. Readers
+ * never need the lock, since an index is only ever replaced by
+ * rename(2) (see writeFile).
+ */
+#define REBUILD_WAIT_MS 1000
+#define REBUILD_POLL_MS 10
+#define LOCK_SUFFIX ".lock"
+
+enum {
+    REBUILD_BUSY = 0,   // somebody else still is at it
+    REBUILD_LOCKED      // it's ours to do
+};
+
+/**
+ * lockRebuild
+ *
+ * Takes the lock on rebuilding the index at path, waiting a bit if
+ * somebody else has it.
+ *
+ * @returns one of the above; *fd is for unlockRebuild
+ */
+static int lockRebuild(const char* path, int* fd)
+{
+    *fd = -1;
+#if HAVE_FLOCK
+    char* lockPath = malloc(strlen(path) + sizeof(LOCK_SUFFIX));
+    strcpy(lockPath, path);
+    strcat(lockPath, LOCK_SUFFIX);
+    makeParents(path, 0700);
+    *fd = open(lockPath, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+    free(lockPath);
+    // without a lock file there is nobody to wait for
+    if(*fd < 0) return REBUILD_LOCKED;
+    if(flock(*fd, LOCK_EX|LOCK_NB) == 0 || errno != EWOULDBLOCK) return REBUILD_LOCKED;
+    for(int waited = 0; waited < REBUILD_WAIT_MS; waited += REBUILD_POLL_MS) {
+        struct timespec ts;
+        ts.tv_sec = 0;
+        ts.tv_nsec = REBUILD_POLL_MS * 1000000L;
+        nanosleep(&ts, NULL);
+        if(flock(*fd, LOCK_EX|LOCK_NB) == 0 || errno != EWOULDBLOCK) return REBUILD_LOCKED;
+    }
+    close(*fd);
+    *fd = -1;
+    return REBUILD_BUSY;
+#else
+    (void)path;
+    return REBUILD_LOCKED;
+#endif
+}
+
+// the lock goes with the file description
+static inline void unlockRebuild(int fd)
+{
+    if(fd >= 0) close(fd);
+}
+
+/**
+ * loadOld
+ *
+ * Loads the index at path into old, on top of shared if it was built on
+ * that.
+ *
+ * @returns 1 if it is fresh
+ */
+static int loadOld(const char* path, struct index* old, struct index* shared, struct entry* sharedHead, int* sharedIsFresh)
+{
+    if(!loadIndex(path, old)) return 0;
+    // with the names in another language, none of it is any use
+    if(!isLocalizedLikeUs(old)) {
+        releaseIndex(old);
+        return 0;
+    }
+    // with a shared index around, only an overlay of it will do
+    if(shared && isOverlayOf(old, shared)) old->base = shared;
+    // but a stale one is no use until root rebuilds it
+    if(shared && !old->base && *sharedIsFresh < 0)
+        *sharedIsFresh = dirsAreFresh(shared, sharedHead, NULL);
+    return (old->base || *sharedIsFresh < 1) && indexIsFresh(old);
+}
+
+// whether the file at path isn't the one old was loaded from
+static int indexWasReplaced(const char* path, const struct index* old)
+{
+    struct stat st;
+    if(stat(path, &st) != 0) return 0;
+    return !old->header || old->ino != st.st_ino
+        || old->mtimeSec != st.st_mtim.tv_sec || old->mtimeNsec != st.st_mtim.tv_nsec;
+}
+
+// whether idx, fresh or not, is a menu with the same options and path=
+// directories as ours
+static int isMenuLikeUs(const struct index* idx, struct entry* sharedHead)
+{
+    uint32_t flags = indexFlags() | (idx->base ? INDEX_OVERLAY : 0);
+    return idx->header->flags == flags && isCollatedLikeUs(idx)
+        && compareDirs(idx, SLIST_FIRST(&dirs), idx->base ? sharedHead : NULL, 0);
+}
+
+/**
+ * buildMenu
+ *
+ * Gets idx ready to render: from the cache if it is fresh and tryCache
+ * is set, otherwise by rebuilding it (and refreshing the cache; see
+ * Rebuilds). The rebuild only parses the files the cache has no current
+ * record of, and none at all in the directories a usable shared index
+ * covers.
+ */
+static void buildMenu(struct index* idx, int tryCache)
+{
+    struct index old;
+    struct timing t;
+    phaseBegin(&t);
+    memset(idx, 0, sizeof(struct index));
+    memset(&old, 0, sizeof(struct index));
+    struct entry* sharedHead = NULL;
+    struct index* shared = loadShared(&sharedHead);
+    int sharedIsFresh = -1;   // not checked yet
+    char* path = useCache && cachePath ? localizedPath(cachePath) : NULL;
+    int fresh = path && loadOld(path, &old, shared, sharedHead, &sharedIsFresh) && tryCache;
+    int lockFd = -1;
+    int lock = fresh || !path ? REBUILD_LOCKED : lockRebuild(path, &lockFd);
+    if(lock != REBUILD_BUSY && path && indexWasReplaced(path, &old)) {
+        // somebody just saved an index, quite likely the one we need
+        old.base = NULL;
+        releaseIndex(&old);
+        fresh = loadOld(path, &old, shared, sharedHead, &sharedIsFresh) && tryCache;
+    } else if(lock == REBUILD_BUSY && tryCache && old.header && isMenuLikeUs(&old, sharedHead)) {
+        // the previous one will do until then
+        fresh = 1;
+    }
+    if(fresh) {
+        if(shared && !old.base) {
+            releaseIndex(shared);
+            free(shared);
+        }
+        *idx = old;
+        phaseEnd(PHASE_LOAD, &t);
+        unlockRebuild(lockFd);
+        free(path);
+        buildIcons();
+        buildExecs(idx);
+        return;
+    }
+    old.base = NULL;
+    // don't save over what whoever has the lock is about to
+    if(lock == REBUILD_BUSY) {
+        free(path);
+        path = NULL;
+    }
+    if(shared && sharedIsFresh < 0)
+        sharedIsFresh = dirsAreFresh(shared, sharedHead, NULL);
+    if(shared && !sharedIsFresh) {
+        releaseIndex(shared);
+        free(shared);
+        shared = NULL;
+        sharedHead = NULL;
+    }
+    phaseEnd(PHASE_LOAD, &t);
+
+    arena_init(&strings);
+    loadLayout(old.header ? &old : NULL);
+
+    // only our own directories get looked at; cut the shared ones off
+    // the end of dirs until the index is built
+    struct entry* np = NULL;
+    if(sharedHead == SLIST_FIRST(&dirs)) {
+        SLIST_FIRST(&dirs) = NULL;
+    } else if(sharedHead) {
+        for(np = SLIST_FIRST(&dirs); SLIST_NEXT(np, entries) != sharedHead; np = SLIST_NEXT(np, entries))
+            ;
+        SLIST_NEXT(np, entries) = NULL;
+    }
+
+    // parse whatever changed since the cache was written
+    parseAll(old.header ? &old : NULL, shared);
+    releaseIndex(&old);
+    phaseBegin(&t);
+    sortModel();
+    phaseEnd(PHASE_SORT, &t);
+    // nobody needs the search index if it is neither saved nor searched
+    if((useCache && cachePath) || query) {
+        phaseBegin(&t);
+        buildGrams();
+        phaseEnd(PHASE_GRAMS, &t);
+    }
+
+    buildIndex(idx, shared);
+    if(sharedHead) {
+        if(SLIST_EMPTY(&dirs)) {
+            SLIST_FIRST(&dirs) = sharedHead;
+        } else {
+            for(np = SLIST_FIRST(&dirs); SLIST_NEXT(np, entries); np = SLIST_NEXT(np, entries))
+                ;
+            SLIST_NEXT(np, entries) = sharedHead;
         }
+    }
+    if(path) {
+        phaseBegin(&t);
+        writeIndex(path, idx);
+        phaseEnd(PHASE_SAVE, &t);
+    }
+    unlockRebuild(lockFd);
+    free(path);
+    buildIcons();
+    buildExecs(idx);
+}
+
+static void dropMenu(struct index* idx)
+{
+    releaseIndex(idx);
+    releaseIcons(&icons);
+    releaseExecs(&execs);
+    freeModel();
+}
+
+/*
+ * Daemon
+ *
+ * jakobmenu --daemon keeps the rendered menu in memory and hands it to
+ * anyone who connects to a per-user Unix socket; jakobmenu --client is
+ * what Openbox runs instead, and only copies those bytes to stdout.
+ *
+ * The menu is rebuilt when inotify reports a change in one of the path=
+ * directories. Directories that can't be watched (e.g. because they
+ * don't exist yet), or systems without inotify, fall back to the
+ * per-directory stat(2) check of the index before each request.
+ *
+ * A client sends one request line and shuts down its end; an empty line
+ * asks for the whole menu.
+ */
+#define DAEMON_REBUILD_DELAY_MS 200
+#define DAEMON_IO_TIMEOUT_S 2
+#define DAEMON_MAX_REQUEST 4096
+
+static volatile sig_atomic_t daemonQuit = 0;
+
+static int64_t monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void onDaemonSignal(int sig)
+{
+    (void)sig;
+    daemonQuit = 1;
+}
+
+/**
+ * socketPath
+ *
+ * @returns $XDG_RUNTIME_DIR/jakobmenu.sock, or if that is not set,
+ *          /tmp/jakobmenu-$UID/jakobmenu.sock, in a directory nobody but
+ *          us can get into; NULL if the path is too long, or that
+ *          directory isn't ours
+ */
+static char* socketPath()
+{
+    struct sockaddr_un sun;
+    char* rval = malloc(sizeof(sun.sun_path));
+    const char* runtime = getenv("XDG_RUNTIME_DIR");
+    int n;
+    if(runtime && *runtime) {
+        n = snprintf(rval, sizeof(sun.sun_path), "%s/jakobmenu.sock", runtime);
     } else {
-        free(Name);
-        free(Exec);
-        free(Categories);
-        free(Icon);
-        free(Path);
+        // anybody can put things in /tmp, so only a directory of our own
+        // will do
+        char dir[sizeof(sun.sun_path)];
+        struct stat st;
+        snprintf(dir, sizeof(dir), "/tmp/jakobmenu-%lu", (unsigned long)getuid());
+        if(mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            warn("Failed to create %s", dir);
+            free(rval);
+            return NULL;
+        }
+        if(lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode)
+                || st.st_uid != getuid() || (st.st_mode & 077)) {
+            fprintf(stderr, "Not using %s, which isn't a private directory of ours\n", dir);
+            free(rval);
+            return NULL;
+        }
+        n = snprintf(rval, sizeof(sun.sun_path), "%s/jakobmenu.sock", dir);
+    }
+    if(n < 0 || (size_t)n >= sizeof(sun.sun_path)) {
+        fprintf(stderr, "Socket path too long\n");
+        free(rval);
+        return NULL;
     }
+    return rval;
+}
 
-    fclose(f);
+// whether the other end of the socket fd runs as us
+static int peerIsUs(int fd)
+{
+#if HAVE_GETPEEREID
+    uid_t uid;
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#elif HAVE_SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == getuid();
+#else
+    // no telling; and a menu is a list of commands to run
+    (void)fd;
+    return 0;
+#endif
 }
 
-static void parseAll()
+static int connectTo(const char* path)
 {
-    struct entry *np = NULL;
-    for(np = SLIST_FIRST(&dirs); np != NULL; np = SLIST_NEXT(np, entries)) {
-        DIR* dir;
-        struct dirent* dep = NULL;
-        dir = opendir(np->path);
-        if(!dir) continue;
-        while((dep = readdir(dir)) != NULL) {
-            static const char dotDesktop[] = ".desktop";
-            static const size_t dotDesktopLen = sizeof(dotDesktop) - 1;
-            size_t namelen = strlen(dep->d_name);
-            if(namelen > dotDesktopLen &&
-                    strcmp(dep->d_name + namelen - dotDesktopLen, dotDesktop) == 0)
-            {
-                int endsInSlash = (*np->path && np->path[strlen(np->path)-1] == '/');
-                char* fullPath = (char*)malloc(strlen(np->path) + !endsInSlash + namelen + 1);
-                strcpy(fullPath, np->path);
-                if(!endsInSlash) strcat(fullPath, "/");
-                strcat(fullPath, dep->d_name);
-                parseDotDesktop(fullPath);
-                free(fullPath);
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void setTimeouts(int fd)
+{
+    struct timeval tv;
+    tv.tv_sec = DAEMON_IO_TIMEOUT_S;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+#if HAVE_INOTIFY
+// (re)adds an inotify watch on path; @returns 1 if it is watched
+static int watchDir(int ifd, const char* path)
+{
+    return inotify_add_watch(ifd, path,
+            IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO
+            |IN_CLOSE_WRITE|IN_ATTRIB|IN_DELETE_SELF|IN_MOVE_SELF) >= 0;
+}
+
+/**
+ * watchDirs
+ *
+ * (Re)adds an inotify watch on every path= directory, and on the
+ * layout= file.
+ *
+ * @returns 1 if all of them are watched
+ */
+static int watchDirs(int ifd)
+{
+    int all = 1;
+    struct entry* np = NULL;
+    SLIST_FOREACH(np, &dirs, entries)
+        if(!watchDir(ifd, np->path)) all = 0;
+    // a file, but what matters about it is the same
+    if(layoutPath && !watchDir(ifd, layoutPath)) all = 0;
+    return all;
+}
+
+/**
+ * watchSubdirs
+ *
+ * With recurse=, the subdirectories are only known once a rebuild has
+ * walked them, so that is when they get watched.
+ *
+ * @returns 1 if one of them changed before its watch was in place
+ */
+static int watchSubdirs(int ifd, const struct index* idx, int* allWatched)
+{
+    if(ifd < 0 || !recurseDepth) return 0;
+    *allWatched = watchDirs(ifd);
+    // a shared index's subdirectories were never walked by us
+    const struct index* base = idx->base;
+    for(uint32_t i = 0; base && i < base->header->ndirs; ++i)
+        if(base->dirs[i].depth && !watchDir(ifd, INDEX_STR(base, base->dirs[i].path)))
+            *allWatched = 0;
+    return !indexIsFresh(idx);
+}
+
+/**
+ * watchExecs
+ *
+ * Watches the $PATH directories TryExec= is checked against, if any.
+ *
+ * @returns 1 if one of them changed before its watch was in place
+ */
+static int watchExecs(int ifd, int* allWatched)
+{
+    if(ifd < 0 || !execs.header) return 0;
+    for(uint32_t i = 0; i < execs.header->ndirs; ++i)
+        if(execs.dirs[i].exists && !watchDir(ifd, INDEX_STR(&execs, execs.dirs[i].path)))
+            *allWatched = 0;
+    return !execsAreFresh(&execs, execsKey());
+}
+#endif
+
+static void serveClient(int fd, const struct output* menu)
+{
+    char request[DAEMON_MAX_REQUEST];
+    size_t len = 0;
+
+    setTimeouts(fd);
+    // read the request line; there is only one kind of request for now
+    while(len < sizeof(request)) {
+        ssize_t n = read(fd, request + len, sizeof(request) - len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        if(memchr(request + len, '\n', n)) break;
+        len += n;
+    }
+
+    output_write(menu, fd);
+}
+
+static int runDaemon()
+{
+    char* path = socketPath();
+    if(!path) return 1;
+
+    // refuse to steal the socket of a running daemon
+    int probe = connectTo(path);
+    if(probe >= 0) {
+        close(probe);
+        fprintf(stderr, "A daemon is already listening on %s\n", path);
+        free(path);
+        return 1;
+    }
+    unlink(path);
+
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+    int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t oldMask = umask(077);
+    if(lfd < 0
+            || bind(lfd, (struct sockaddr*)&sun, sizeof(sun)) != 0
+            || listen(lfd, 16) != 0)
+    {
+        umask(oldMask);
+        warn("Failed to listen on %s", path);
+        free(path);
+        return 1;
+    }
+    umask(oldMask);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = &onDaemonSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    int ifd = -1, allWatched = 0;
+#if HAVE_INOTIFY
+    ifd = inotify_init();
+    // watch before parsing, so no change can slip in between
+    if(ifd >= 0) allWatched = watchDirs(ifd);
+#endif
+
+    struct index idx;
+    struct output menu;
+    int dirty = 0;
+    int64_t rebuildAt = 0;  // once dirty; requests don't put it off
+    // a menu from the cache leaves us not knowing the subdirectories
+    buildMenu(&idx, !recurseDepth);
+#if HAVE_INOTIFY
+    dirty = watchSubdirs(ifd, &idx, &allWatched);
+    if(watchExecs(ifd, &allWatched)) dirty = 1;
+#endif
+    render(&idx, &menu);
+
+    while(!daemonQuit) {
+        struct pollfd pfd[2];
+        int npfd = 0;
+        pfd[npfd].fd = lfd;
+        pfd[npfd++].events = POLLIN;
+        if(ifd >= 0) {
+            pfd[npfd].fd = ifd;
+            pfd[npfd++].events = POLLIN;
+        }
+        // after a change wait for things to settle, packages come in
+        // bunches; but only so long after the first one
+        int timeout = -1;
+        if(dirty) {
+            if(!rebuildAt) rebuildAt = monotonicMs() + DAEMON_REBUILD_DELAY_MS;
+            int64_t left = rebuildAt - monotonicMs();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        int n = poll(pfd, npfd, timeout);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            warn("poll");
+            break;
+        }
+
+        if(dirty && monotonicMs() >= rebuildAt) {
+            rebuildAt = 0;
+#if HAVE_INOTIFY
+            if(ifd >= 0) allWatched = watchDirs(ifd);
+#endif
+            dirty = 0;
+            dropMenu(&idx);
+            buildMenu(&idx, 0);
+#if HAVE_INOTIFY
+            dirty = watchSubdirs(ifd, &idx, &allWatched);
+            if(watchExecs(ifd, &allWatched)) dirty = 1;
+#endif
+            output_free(&menu);
+            render(&idx, &menu);
+            continue;
+        }
+
+        if(npfd > 1 && (pfd[1].revents & POLLIN)) {
+            char events[4096];
+            while(read(ifd, events, sizeof(events)) < 0 && errno == EINTR)
+                ;
+            dirty = 1;
+            continue;
+        }
+
+        if(pfd[0].revents & POLLIN) {
+            int cfd = accept(lfd, NULL, NULL);
+            if(cfd < 0) continue;
+            // without a watch on everything, check before answering
+            if(!allWatched && (!indexIsFresh(&idx)
+                        || (execs.header && !execsAreFresh(&execs, execsKey())))) {
+                dropMenu(&idx);
+                buildMenu(&idx, 0);
+#if HAVE_INOTIFY
+                dirty = watchSubdirs(ifd, &idx, &allWatched);
+                if(watchExecs(ifd, &allWatched)) dirty = 1;
+#endif
+                output_free(&menu);
+                render(&idx, &menu);
             }
+            serveClient(cfd, &menu);
+            close(cfd);
+        }
+    }
+
+    close(lfd);
+    unlink(path);
+    if(ifd >= 0) close(ifd);
+    free(path);
+    output_free(&menu);
+    dropMenu(&idx);
+    return 0;
+}
+
+/**
+ * runClient
+ *
+ * Asks the daemon for the menu and copies it to stdout.
+ *
+ * @returns 1 if the menu came from the daemon, 0 if there is no daemon
+ */
+static int runClient()
+{
+    char* path = socketPath();
+    if(!path) return 0;
+    int fd = connectTo(path);
+    free(path);
+    if(fd < 0) return 0;
+    // anybody else's menu could run anything
+    if(!peerIsUs(fd)) {
+        fprintf(stderr, "The daemon's socket belongs to another user; ignoring it\n");
+        close(fd);
+        return 0;
+    }
+
+    setTimeouts(fd);
+    while(write(fd, "\n", 1) < 0 && errno == EINTR)
+        ;
+    shutdown(fd, SHUT_WR);
+
+#if HAVE_SPLICE
+    // straight from the socket into Openbox's pipe, if stdout is one
+    for(;;) {
+        ssize_t n = splice(fd, NULL, STDOUT_FILENO, NULL, 1 << 16, SPLICE_F_MOVE);
+        if(n < 0 && errno == EINTR) continue;
+        if(n == 0) {
+            close(fd);
+            return 1;
         }
-        closedir(dir);
+        if(n < 0) break;
+    }
+    // EINVAL: stdout is not a pipe; carry on below with whatever is left
+#endif
+    char buf[1 << 16];
+    for(;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) break;
+        struct outbuf o;
+        o.buf = buf;
+        o.len = n;
+        o.cap = sizeof(buf);
+        if(!out_flush(&o, STDOUT_FILENO)) break;
     }
+    close(fd);
+    return 1;
 }
 
 void version(int yesexit)
@@ -557,11 +5890,24 @@ void usage(const char* argv0)
     version(0);
     fprintf(stderr,
 "" "\n"
-"Usage: %s [-%s]" "\n"
+"Usage: %s [--daemon|--client|--shared-index] [-%s]" "\n"
 "\t"    "-h                     prints this message and exits" "\n"
 "\t"    "-V                     prints version information and exits" "\n"
 "\t"    "-a                     duplicate items in all declared categories" "\n"
 "\t"    "-p /some/path/         add a search path" "\n"
+"\t"    "-R N                   also search N levels of subdirectories" "\n"
+"\t"    "-n                     do not read or write the menu cache" "\n"
+"\t"    "-j N                   work with N threads (default: one per CPU)" "\n"
+"\t"    "-T                     report time spent and work done to stderr" "\n"
+"\t"    "-J                     like -T, but as JSON" "\n"
+"\t"    "-i THEME               add icons from this icon theme" "\n"
+"\t"    "-l                     make each category a pipe menu of its own" "\n"
+"\t"    "-C CATEGORY            print only the items in CATEGORY" "\n"
+"\t"    "-s QUERY               print only the items matching QUERY" "\n"
+"\t"    "--daemon               serve the menu over a Unix socket" "\n"
+"\t"    "--client               print the menu served by the daemon, if any" "\n"
+"\t"    "--shared-index         update the index of the system paths that" "\n"
+"\t"    "                       every user's menu is built on (run as root)" "\n"
 "" "\n"
 "This program will output an <openbox_pipe_menu/> structure compatible" "\n"
 "with OpenBox." "\n"
@@ -579,50 +5925,98 @@ void usage(const char* argv0)
     exit(2);
 }
 
+// passes an option on to the pipe menus -l makes
+static void forwardOption(struct outbuf* o, int ch, const char* arg)
+{
+    char opt[] = { ' ', '-', (char)ch };
+    out_append(o, opt, sizeof(opt));
+    if(arg) {
+        OUT_LITERAL(o, " ");
+        out_shellQuoted(o, arg);
+    }
+}
+
 #if HAVE_UNVEIL
+// a directory's unveil covers every file in it, including the ones which
+// only show up later on (the daemon rescans after unveil is locked)
 void unveilAll()
 {
     struct entry *np = NULL;
-    for(np = SLIST_FIRST(&dirs); np != NULL; np = SLIST_NEXT(np, entries)) {
-        DIR* dir;
-        struct dirent *dep = NULL;
+    SLIST_FOREACH(np, &dirs, entries)
         unveil(np->path, "r");
-        dir = opendir(np->path);
-        if(!dir) continue;
-        while((dep = readdir(dir)) != NULL) {
-            if(dep == NULL) break;
-
-            static const char dotDesktop[] = ".desktop";
-            static const size_t dotDesktopLen = sizeof(dotDesktop) - 1;
-            size_t namelen = strlen(dep->d_name);
-            if(namelen > dotDesktopLen &&
-                    strcmp(dep->d_name + namelen - dotDesktopLen, dotDesktop) == 0)
-            {
-                int endsInSlash = (*np->path && np->path[strlen(np->path)-1] == '/');
-                char* fullPath = (char*)malloc(strlen(np->path) + !endsInSlash + namelen + 1);
-                strcpy(fullPath, np->path);
-                if(!endsInSlash) strcat(fullPath, "/");
-                strcat(fullPath, dep->d_name);
-                unveil(fullPath, "r");
-                free(fullPath);
-            }
+    if(layoutPath) unveil(layoutPath, "r");
+
+    // and where buildIcons looks
+    if(iconTheme) {
+        size_t nbases = 0;
+        char** bases = iconBaseDirs(&nbases);
+        for(size_t i = 0; i < nbases; ++i) {
+            unveil(bases[i], "r");
+            free(bases[i]);
         }
-        closedir(dir);
+        free(bases);
+        unveil("/usr/share/pixmaps", "r");
     }
+
+    // and where TryExec= is looked for
+    char* path = strdup(execsKey());
+    char* save = NULL;
+    for(char* dir = strtok_r(path, ":", &save); dir; dir = strtok_r(NULL, ":", &save))
+        if(*dir == '/') unveil(dir, "rx");
+    free(path);
 }
 #endif
 
 int main(int argc, char* argv[])
 {
+    // -T isn't known until after the rc files are read, so these are
+    // always taken
+    struct timing start, rcStart, rcEnd;
+    timingNow(&start);
+
     SLIST_INIT(&dirs);
 
+    // the sort order follows LC_COLLATE (see Collation); nothing else
+    // calls setlocale, so what it returns stays put
+    const char* locale = setlocale(LC_COLLATE, "");
+    if(locale) {
+        collation = locale;
+        foldCase = strcmp(locale, "C") == 0 || strcmp(locale, "POSIX") == 0
+            || strncmp(locale, "C.", 2) == 0;
+    }
+    // the names follow LC_MESSAGES, which needn't be installed for that
+    // (see Locale)
+    initLocale();
+
 #if HAVE_PLEDGE
     // pledges
-    if(pledge("stdio rpath unveil", NULL))
+    if(pledge("stdio rpath wpath cpath flock unix unveil", NULL))
         err(1, "Failed to pledge");
 #endif
 
+#ifdef _SC_NPROCESSORS_ONLN
+    numJobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numJobs < 1) numJobs = 1;
+#endif
+
+    // getopt doesn't do long options; pick ours out first, since
+    // --shared-index decides which rc files count
+    int mode = MODE_MENU;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--") == 0) break;
+        if(strcmp(argv[i], "--daemon") == 0) mode = MODE_DAEMON;
+        else if(strcmp(argv[i], "--client") == 0) mode = MODE_CLIENT;
+        else if(strcmp(argv[i], "--shared-index") == 0) mode = MODE_SHARED;
+        else continue;
+        memmove(&argv[i], &argv[i + 1], (argc - i) * sizeof(char*));
+        --argc;
+        --i;
+    }
+    indexingShared = mode == MODE_SHARED;
+
     char* realHomeConf = expand(HOME_CONF);
+    cachePath = expand(HOME_CACHE);
+    sharedCachePath = strdup(SHARED_CACHE);
 
 #if HAVE_UNVEIL
     // unveil rc files
@@ -630,9 +6024,11 @@ int main(int argc, char* argv[])
     unveil(realHomeConf, "r");
 #endif
 
-    // parse rc files
+    // parse rc files; the shared index is the same for everyone
+    timingNow(&rcStart);
     parseRC(ETC_CONF);
-    parseRC(realHomeConf);
+    if(!indexingShared) parseRC(realHomeConf);
+    timingNow(&rcEnd);
 
     free(realHomeConf);
 
@@ -641,6 +6037,12 @@ int main(int argc, char* argv[])
     // - add command line flag to create submenus per categories, or per top level path
     // - add rc commands for the above
     // - add command line flag to skip parsing config files, and change the order we parse things in... pfff
+
+    // -l's pipe menus get to see what we saw
+    struct outbuf forward;
+    memset(&forward, 0, sizeof(forward));
+    out_shellQuoted(&forward, argv[0]);
+
     int ch;
     while((ch = getopt(argc, argv, OPTSTRING)) != -1) {
         switch(ch) {
@@ -653,71 +6055,159 @@ int main(int argc, char* argv[])
                 break;
             case 'p':
                 addPath(optarg);
+                forwardOption(&forward, ch, optarg);
                 break;
             case 'a':
                 useAllCategories = 1;
+                forwardOption(&forward, ch, NULL);
+                break;
+            case 'n':
+                useCache = 0;
+                forwardOption(&forward, ch, NULL);
+                break;
+            case 'j':
+                numJobs = atol(optarg);
+                if(numJobs < 1) usage(argv[0]);
+                forwardOption(&forward, ch, optarg);
+                break;
+            case 'T':
+                if(!reportStats) reportStats = 1;
+                break;
+            case 'J':
+                reportStats = 2;
+                break;
+            case 'i':
+                free(iconTheme);
+                iconTheme = strdup(optarg);
+                forwardOption(&forward, ch, optarg);
+                break;
+            case 'l':
+                lazyMenus = 1;
+                break;
+            case 'C':
+                onlyCategory = optarg;
+                break;
+            case 's':
+                query = optarg;
+                break;
+            case 'R':
+                recurseDepth = atol(optarg);
+                if(recurseDepth < 0 || recurseDepth > MAX_RECURSE) usage(argv[0]);
+                forwardOption(&forward, ch, optarg);
                 break;
             default:
                 usage(argv[0]);
         }
     }
+    stats.phases[PHASE_RC].wall = rcEnd.wall - rcStart.wall;
+    stats.phases[PHASE_RC].cpu = rcEnd.cpu - rcStart.cpu;
     argc -= optind;
     argv += optind;
+    out_append(&forward, "", 1);
+    subMenuCommand = forward.buf;
+
+    // --shared-index writes what the others read, and for all of them
+    if(indexingShared) {
+        free(cachePath);
+        cachePath = sharedCachePath;
+        sharedCachePath = NULL;
+        free(iconTheme);
+        iconTheme = NULL;
+        umask(022);
+        makeParents(cachePath, 0755);
+    }
 
 #if HAVE_UNVEIL
     // unveil all .desktop files
     unveilAll();
 
+    // the cache is replaced via rename(2), so unveil its directory
+    if(useCache && cachePath) {
+        char* cacheDir = strdup(cachePath);
+        char* slash = strrchr(cacheDir, '/');
+        if(slash && slash != cacheDir) {
+            *slash = '\0';
+            makeParents(cachePath, 0700);
+            unveil(cacheDir, "rwc");
+        }
+        free(cacheDir);
+    }
+    if(useCache && sharedCachePath) {
+        char* sharedDir = strdup(sharedCachePath);
+        char* slash = strrchr(sharedDir, '/');
+        if(slash && slash != sharedDir) {
+            *slash = '\0';
+            unveil(sharedDir, "r");
+        }
+        free(sharedDir);
+    }
+
+    // the socket lives outside of everything else
+    if(mode == MODE_DAEMON || mode == MODE_CLIENT) {
+        char* sockPath = socketPath();
+        if(sockPath) unveil(sockPath, "rwc");
+        free(sockPath);
+    }
+
     // no more unveils
     unveil(NULL, NULL);
 #endif
 
 #if HAVE_PLEDGE
     // no further pledges
-    pledge("stdio rpath", NULL);
+    if(mode == MODE_MENU || mode == MODE_SHARED)
+        pledge("stdio rpath wpath cpath flock", NULL);
+    else
+        pledge("stdio rpath wpath cpath flock unix", NULL);
     pledge(NULL, NULL);
 #endif
 
-    categories = calloc(DEFAULT_CAPACITY, sizeof(struct category*));
-
-    // parse all files
-    parseAll();
-    qsort(categories, ncategories, sizeof(struct category*), &compare_categories);
-
-    printf("<openbox_pipe_menu>\n");
-    for(int i = 0; i < ncategories; ++i) {
-        struct category *category = categories[i];
-        printf(" <menu id=\"%s\" label=\"%s\">\n", category->name, category->name);
-        qsort(category->members, category->nmembers, sizeof(struct item*), &compare_items);
-        for(int j = 0; j < category->nmembers; ++j) {
-            char* buffer = NULL;
-            const char* toExec = category->members[j]->Exec;
-            if(category->members[j]->useTerminal) {
-                buffer = malloc(strlen(toExec) + strlen("xterm -e ") + 1);
-                strcpy(buffer, "xterm -e ");
-                strcat(buffer, toExec);
-                toExec = buffer;
-            }
-            printf("  <item label=\"%s\"><action name=\"Execute\"><execute>"
-                    "%s</execute></action></item>\n",
-                    category->members[j]->Name,
-                    toExec);
-            free(buffer);
-        }
-        printf(" </menu>\n");
+    struct index idx;
+    if(mode == MODE_DAEMON) {
+        int rval = runDaemon();
+        free(cachePath);
+        free(sharedCachePath);
+        return rval;
+    }
+    // the daemon only has the whole menu
+    if(mode == MODE_CLIENT && !onlyCategory && !query && runClient()) {
+        free(cachePath);
+        free(sharedCachePath);
+        return 0;
     }
-    printf("</openbox_pipe_menu>\n");
 
-#if DELETE_CATEGORIES
-    for(struct category** p = categories; p != categories + ncategories; ++p) {
-        delete_category(p);
+    buildMenu(&idx, 1);
+
+    // --shared-index is done once the index is
+    if(mode != MODE_SHARED) {
+        struct output out;
+        struct timing t;
+        phaseBegin(&t);
+        if(query || onlyCategory) output_init(&out, 1);
+        if(query) renderSearch(&idx, query, &out.parts[0]);
+        else if(onlyCategory) renderCategory(&idx, onlyCategory, &out.parts[0]);
+        else render(&idx, &out);
+        phaseEnd(PHASE_RENDER, &t);
+        phaseBegin(&t);
+        if(!output_write(&out, STDOUT_FILENO))
+            warn("Failed to write the menu");
+        phaseEnd(PHASE_OUTPUT, &t);
+        output_free(&out);
     }
+
+    dropMenu(&idx);
     while(!SLIST_EMPTY(&dirs)) {
         struct entry* n = SLIST_FIRST(&dirs);
         SLIST_REMOVE_HEAD(&dirs, entries);
-        free(n);
+        freeEntry(n);
     }
-#endif
+    free(cachePath);
+    free(sharedCachePath);
+    free(layoutPath);
+    free(iconTheme);
+    free(subMenuCommand);
+
+    if(reportStats) printStats(&start);
 
     return 0;
 }